@@ -0,0 +1,166 @@
+// Teste de interoperabilidade: envia um ficheiro de vários pacotes entre dois executáveis da aplicação
+// (por exemplo o antigo e o atual) ligados por ptys, e compara o ficheiro recebido com o enviado
+//
+// Compilar e correr (a partir de TP1/):
+//   gcc -O2 -o bench/interop_test bench/interop_test.c -lpthread
+//   ./bench/interop_test <programa do recetor> <programa do emissor> [tamanho do ficheiro]
+//
+// Correr nos dois sentidos, com o executável antigo de cada lado. O tamanho por omissão passa de um pacote
+// da aplicação antiga (502 bytes de dados), para apanhar pacotes maiores do que os buffers dela: compilar a
+// application_layer.c antiga com -fsanitize=address para que um pacote grande demais falhe em vez de passar.
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FALSE 0
+#define TRUE 1
+
+#define TEST_SIZE (4 * 502 + 123)
+#define TEST_TIMEOUT_S 120
+
+volatile int relay_running = TRUE;
+int masters[2];
+
+// Abre um pty e devolve o descritor do lado mestre, com o caminho do lado escravo em path
+int open_pty(char *path, int size) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        exit(1);
+    }
+    snprintf(path, size, "%s", ptsname(master));
+    return master;
+}
+
+// Copia os bytes entre os dois lados mestre até o teste terminar
+void *relay(void *arg) {
+    (void)arg;
+    unsigned char buf[4096];
+    struct pollfd pfds[2] = {
+        { masters[0], POLLIN, 0 },
+        { masters[1], POLLIN, 0 },
+    };
+
+    while (relay_running) {
+        if (poll(pfds, 2, 100) <= 0) continue;
+        for (int i = 0; i < 2; i++) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            int n = read(masters[i], buf, sizeof(buf));
+            if (n > 0 && write(masters[1 - i], buf, n) != n) perror("relay");
+        }
+    }
+    return NULL;
+}
+
+// Corre program port role filename noutro processo, com a saída descartada
+pid_t run(const char *program, const char *port, const char *role, const char *filename) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execl(program, program, port, role, filename, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Espera pelo processo pid até ao fim do prazo (deadline, em segundos do relógio monotónico) e mata-o se passar
+// Retorna o estado de saída do processo, ou -1 se foi morto ou terminou com um sinal
+int wait_until(pid_t pid, time_t deadline) {
+    int status;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec >= deadline) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        usleep(100000);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Compara os ficheiros a e b; retorna TRUE se forem iguais
+int same_file(const char *a, const char *b) {
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int same = (fa != NULL && fb != NULL);
+    while (same) {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        if (ca != cb) same = FALSE;
+        if (ca == EOF || cb == EOF) break;
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return same;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s rx_program tx_program [file size]\n", argv[0]);
+        return 2;
+    }
+    int size = (argc > 3) ? atoi(argv[3]) : TEST_SIZE;
+
+    // ficheiro a enviar, com bytes aleatórios (incluindo FLAG e ESCAPE)
+    char source[] = "/tmp/interop_src_XXXXXX";
+    char received[] = "/tmp/interop_out_XXXXXX";
+    int fd = mkstemp(source);
+    int out = mkstemp(received);
+    if (fd < 0 || out < 0) {
+        perror("mkstemp");
+        return 2;
+    }
+    close(out);
+    unlink(received);
+    srand(time(NULL));
+    for (int i = 0; i < size; i++) {
+        unsigned char byte = rand();
+        if (write(fd, &byte, 1) != 1) {
+            perror("write");
+            return 2;
+        }
+    }
+    close(fd);
+
+    char ports[2][64];
+    masters[0] = open_pty(ports[0], sizeof(ports[0]));
+    masters[1] = open_pty(ports[1], sizeof(ports[1]));
+    pthread_t relay_thread;
+    pthread_create(&relay_thread, NULL, relay, NULL);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    time_t deadline = now.tv_sec + TEST_TIMEOUT_S;
+
+    // o recetor primeiro, para já estar à espera do SET
+    pid_t rx = run(argv[1], ports[1], "rx", received);
+    usleep(300000);
+    pid_t tx = run(argv[2], ports[0], "tx", source);
+    int tx_status = wait_until(tx, deadline);
+    int rx_status = wait_until(rx, deadline);
+
+    relay_running = FALSE;
+    pthread_join(relay_thread, NULL);
+
+    int same = same_file(source, received);
+    printf("%s: %d bytes de %s para %s (saída do emissor %d, do recetor %d)\n", same ? "OK" : "FAIL", size,
+           argv[2], argv[1], tx_status, rx_status);
+
+    unlink(source);
+    unlink(received);
+    return (same && tx_status == 0 && rx_status == 0) ? 0 : 1;
+}
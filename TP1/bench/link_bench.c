@@ -0,0 +1,124 @@
+// Benchmark da camada de ligação: tramas I por segundo entre duas sessões ligadas por ptys
+//
+// Compilar e correr (a partir de TP1/, com o link_layer.h do projeto no include path):
+//   gcc -O2 -Iinclude -o bench/link_bench bench/link_bench.c src/link_layer.c src/byte_stuffing.c src/frame_check.c src/reed_solomon.c -lm -lpthread
+//   ./bench/link_bench [número de tramas] [tamanho dos dados]
+//
+// Cada sessão abre o lado escravo de um pty; uma thread copia os bytes entre os dois lados mestre,
+// como um cabo série sem erros.
+
+#define _GNU_SOURCE
+#include "link_session.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_BAUDRATE 115200
+#define BENCH_TRIES 3
+#define BENCH_TIMEOUT 4
+
+volatile int relay_running = TRUE;
+int masters[2];
+int frames = 1000;
+
+// Abre um pty e devolve o descritor do lado mestre, com o caminho do lado escravo em path
+int open_pty(char *path, int size) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        exit(1);
+    }
+    snprintf(path, size, "%s", ptsname(master));
+    return master;
+}
+
+// Copia os bytes entre os dois lados mestre até o benchmark terminar
+void *relay(void *arg) {
+    (void)arg;
+    unsigned char buf[4096];
+    struct pollfd pfds[2] = {
+        { masters[0], POLLIN, 0 },
+        { masters[1], POLLIN, 0 },
+    };
+
+    while (relay_running) {
+        if (poll(pfds, 2, 100) <= 0) continue;
+        for (int i = 0; i < 2; i++) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            int n = read(masters[i], buf, sizeof(buf));
+            if (n > 0 && write(masters[1 - i], buf, n) != n) perror("relay");
+        }
+    }
+    return NULL;
+}
+
+// Recetor: lê as tramas todas e fecha a ligação
+void *receiver(void *arg) {
+    LinkLayer parameters = *(LinkLayer *)arg;
+
+    LinkSession *session = llopen_session(parameters);
+    if (session == NULL) return NULL;
+    unsigned char *packet = malloc(llmax_payload_session(session));
+    for (int i = 0; i < frames; i++) {
+        if (llread_session(session, packet) < 0) break;
+    }
+    llclose_session(session, FALSE);
+    free(packet);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    frames = (argc > 1) ? atoi(argv[1]) : 1000;
+    int size = (argc > 2) ? atoi(argv[2]) : 500;
+
+    LinkLayer tx, rx;
+    memset(&tx, 0, sizeof(tx));
+    masters[0] = open_pty(tx.serialPort, sizeof(tx.serialPort));
+    tx.role = LlTx;
+    tx.baudRate = BENCH_BAUDRATE;
+    tx.nRetransmissions = BENCH_TRIES;
+    tx.timeout = BENCH_TIMEOUT;
+    rx = tx;
+    masters[1] = open_pty(rx.serialPort, sizeof(rx.serialPort));
+    rx.role = LlRx;
+
+    pthread_t relay_thread, rx_thread;
+    pthread_create(&relay_thread, NULL, relay, NULL);
+    pthread_create(&rx_thread, NULL, receiver, &rx);
+
+    unsigned char *data = malloc(size);
+    for (int i = 0; i < size; i++) data[i] = rand();
+
+    LinkSession *session = llopen_session(tx);
+    if (session == NULL) return 1;
+
+    // Mede desde a primeira trama até à confirmação da última (llclose espera pela janela vazia)
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < frames; i++) {
+        if (llwrite_session(session, data, size) < 0) {
+            printf("Error: llwrite failed at frame %d\n", i);
+            return 1;
+        }
+    }
+    int closed = llclose_session(session, FALSE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_join(rx_thread, NULL);
+    relay_running = FALSE;
+    pthread_join(relay_thread, NULL);
+
+    double total_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1E9;
+    printf("%d tramas de %d bytes em %.3f s: %.1f tramas/s, %.1f KB/s%s\n",
+           frames, size, total_time, frames / total_time, (double)frames * size / total_time / 1E3,
+           closed == 1 ? "" : " (erro no llclose)");
+
+    free(data);
+    return 0;
+}
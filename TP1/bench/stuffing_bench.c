@@ -0,0 +1,96 @@
+// Microbenchmark dos kernels de byte stuffing / destuffing
+//
+// Compilar e correr (a partir de TP1/):
+//   gcc -O2 -Iinclude -o bench/stuffing_bench bench/stuffing_bench.c src/byte_stuffing.c -lpthread
+//   ./bench/stuffing_bench [tamanho em bytes] [repetições]
+
+#include "byte_stuffing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FLAG 0x7E
+
+typedef int (*stuff_t)(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2);
+typedef int (*destuff_t)(unsigned char *dst, const unsigned char *src, int size);
+
+typedef struct {
+    const char *name;
+    stuff_t stuff;
+    destuff_t destuff;
+} Kernel;
+
+// Mede o débito (GB/s de entrada) de um kernel (stuff ou destuff, o outro é NULL)
+double measure(stuff_t stuff, destuff_t destuff, unsigned char *dst, const unsigned char *src, int size, int repetitions) {
+    struct timespec start, end;
+    unsigned char bcc2 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < repetitions; r++) {
+        if (stuff) stuff(dst, src, size, &bcc2);
+        else destuff(dst, src, size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double total_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1E9;
+    return ((double)size * repetitions) / total_time / 1E9;
+}
+
+int main(int argc, char *argv[]) {
+    int size = (argc > 1) ? atoi(argv[1]) : 1 << 20;
+    int repetitions = (argc > 2) ? atoi(argv[2]) : 200;
+
+    Kernel kernels[3];
+    int n_kernels = 0;
+    kernels[n_kernels++] = (Kernel){ "scalar", stuff_bytes_scalar, destuff_bytes_scalar };
+#ifdef STUFFING_X86
+    if (cpu_has_sse2()) kernels[n_kernels++] = (Kernel){ "sse2", stuff_bytes_sse2, destuff_bytes_sse2 };
+    if (cpu_has_avx2()) kernels[n_kernels++] = (Kernel){ "avx2", stuff_bytes_avx2, destuff_bytes_avx2 };
+#endif
+
+    // Payloads: aleatório, texto e pior caso (só FLAGs)
+    const char *payload_names[3] = { "random", "text", "all-FLAG" };
+    unsigned char *payloads[3];
+    const char *text = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor. ";
+    srand(1);
+    for (int p = 0; p < 3; p++) payloads[p] = malloc(size);
+    for (int i = 0; i < size; i++) {
+        payloads[0][i] = rand() & 0xFF;
+        payloads[1][i] = text[i % strlen(text)];
+        payloads[2][i] = FLAG;
+    }
+
+    unsigned char *stuffed = malloc(2 * size);
+    unsigned char *reference = malloc(2 * size);
+    unsigned char *destuffed = malloc(2 * size);
+
+    printf("Kernel escolhido em runtime: %s\n", stuffing_kernel_name());
+    printf("%-10s %-8s %14s %14s\n", "payload", "kernel", "stuff GB/s", "destuff GB/s");
+
+    for (int p = 0; p < 3; p++) {
+        unsigned char reference_bcc2 = 0;
+        int stuffed_size = stuff_bytes_scalar(reference, payloads[p], size, &reference_bcc2);
+
+        for (int k = 0; k < n_kernels; k++) {
+            // Confirma que o kernel dá o mesmo resultado (e o mesmo BCC2) que a versão escalar
+            unsigned char bcc2 = 0;
+            int length = kernels[k].stuff(stuffed, payloads[p], size, &bcc2);
+            int destuffed_size = kernels[k].destuff(destuffed, stuffed, length);
+            if (length != stuffed_size || memcmp(stuffed, reference, length) != 0 || bcc2 != reference_bcc2 ||
+                destuffed_size != size || memcmp(destuffed, payloads[p], size) != 0) {
+                printf("Error: %s kernel differs from scalar on %s payload\n", kernels[k].name, payload_names[p]);
+                return 1;
+            }
+
+            double stuff_rate = measure(kernels[k].stuff, NULL, stuffed, payloads[p], size, repetitions);
+            double destuff_rate = measure(NULL, kernels[k].destuff, destuffed, reference, stuffed_size, repetitions);
+            printf("%-10s %-8s %14.3f %14.3f\n", payload_names[p], kernels[k].name, stuff_rate, destuff_rate);
+        }
+    }
+
+    for (int p = 0; p < 3; p++) free(payloads[p]);
+    free(stuffed);
+    free(reference);
+    free(destuffed);
+    return 0;
+}
@@ -0,0 +1,37 @@
+// Byte stuffing kernels header
+
+#ifndef _BYTE_STUFFING_H_
+#define _BYTE_STUFFING_H_
+
+// Faz stuffing (FLAG e ESCAPE passam a ESCAPE, byte ^ 0x20) de size bytes de src para dst,
+// acumulando em *bcc2 o XOR dos bytes de src (BCC2) na mesma passagem.
+// dst tem de ter espaço para 2 * size bytes.
+// Retorna o número de bytes escritos em dst.
+int stuff_bytes(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2);
+
+// Desfaz o stuffing de size bytes de src para dst (dst tem de ter espaço para size bytes).
+// Um ESCAPE no último byte (sem byte seguinte) é ignorado.
+// Retorna o número de bytes escritos em dst.
+int destuff_bytes(unsigned char *dst, const unsigned char *src, int size);
+
+// Nome da implementação escolhida em runtime ("scalar", "sse2" ou "avx2")
+const char *stuffing_kernel_name();
+
+// Implementações disponíveis (a escalar é a referência)
+int stuff_bytes_scalar(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2);
+int destuff_bytes_scalar(unsigned char *dst, const unsigned char *src, int size);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STUFFING_X86 1
+
+int stuff_bytes_sse2(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2);
+int destuff_bytes_sse2(unsigned char *dst, const unsigned char *src, int size);
+int stuff_bytes_avx2(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2);
+int destuff_bytes_avx2(unsigned char *dst, const unsigned char *src, int size);
+
+// Verifica se o processador suporta AVX2 / SSE2
+int cpu_has_avx2();
+int cpu_has_sse2();
+#endif
+
+#endif // _BYTE_STUFFING_H_
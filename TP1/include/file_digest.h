@@ -0,0 +1,47 @@
+// File digest header
+
+#ifndef _FILE_DIGEST_H_
+#define _FILE_DIGEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Algoritmos (o número vai nos pacotes de controlo)
+#define DIGEST_NONE 0
+#define DIGEST_XXH64 1  // xxHash de 64 bits: muito mais rápido do que a linha, só deteta erros
+#define DIGEST_SHA256 2 // SHA-256: mais lento, também serve contra alterações intencionais
+
+// Tamanho máximo de um digest em bytes
+#define DIGEST_MAX_SIZE 32
+
+// Digest calculado por partes, à medida que os dados passam (os blocos podem ter qualquer tamanho).
+typedef struct {
+    int algorithm;
+    uint64_t length;           // bytes já processados
+    unsigned char buffer[64];  // bytes que ainda não completam um bloco
+    int buffered;
+    union {
+        uint64_t xxh64[4];
+        uint32_t sha256[8];
+    } state;
+} FileDigest;
+
+// Tamanho em bytes do digest do algoritmo, ou 0 se o algoritmo não é suportado.
+int digest_size(int algorithm);
+
+// Nome do algoritmo ("xxh64", "sha256" ou "none").
+const char *digest_name(int algorithm);
+
+// Começa um digest novo.
+// Retorna 0 em caso de sucesso ou -1 se o algoritmo não é suportado (o digest fica DIGEST_NONE e
+// digest_update não faz nada).
+int digest_init(FileDigest *digest, int algorithm);
+
+// Acrescenta size bytes de data ao digest.
+void digest_update(FileDigest *digest, const unsigned char *data, size_t size);
+
+// Termina o digest e escreve-o em out (big-endian, digest_size bytes).
+// Retorna o tamanho do digest.
+int digest_final(FileDigest *digest, unsigned char *out);
+
+#endif // _FILE_DIGEST_H_
@@ -0,0 +1,60 @@
+// Frame check header
+
+#ifndef _FRAME_CHECK_H_
+#define _FRAME_CHECK_H_
+
+#include <stdint.h>
+
+// Campo de verificação dos dados das tramas I (no lugar do BCC2), acordado no SET/UA
+#define CHECK_BCC 0    // XOR de 1 byte (o BCC2 original): não deteta dois erros no mesmo bit
+#define CHECK_CRC16 1  // CRC-16-CCITT (o FCS-16 do HDLC), 2 bytes
+#define CHECK_CRC32C 2 // CRC-32C (Castagnoli), 4 bytes
+
+// Tamanho máximo do campo de verificação em bytes
+#define CHECK_MAX_SIZE 4
+
+// Tamanho em bytes do campo de verificação, ou 0 se não é suportado.
+int check_size(int check);
+
+// Nome do campo de verificação ("bcc", "crc16" ou "crc32c").
+const char *check_name(int check);
+
+// Nome da implementação do CRC-32C escolhida em runtime ("sse4.2" ou "slicing-by-8").
+const char *crc32c_kernel_name();
+
+// Valor inicial do registo do campo de verificação.
+uint32_t check_init(int check);
+
+// Acrescenta size bytes de data ao registo crc.
+// Retorna o novo registo.
+uint32_t check_update(int check, uint32_t crc, const unsigned char *data, int size);
+
+// Escreve em out o campo de verificação a enviar depois dos dados (pela ordem em que sai na linha).
+// Retorna o tamanho do campo.
+int check_final(int check, uint32_t crc, unsigned char *out);
+
+// Verifica o registo depois de processar os dados e o campo de verificação recebido a seguir
+// (sem erros fica sempre com o mesmo resíduo).
+// Retorna 1 se estiver correto, 0 se não.
+int check_valid(int check, uint32_t crc);
+
+// Faz stuffing de size bytes de src para dst (como stuff_bytes) e acumula no registo *crc o campo de
+// verificação dos bytes de src na mesma passagem (por blocos que ainda estão na cache).
+// Retorna o número de bytes escritos em dst.
+int stuff_bytes_check(unsigned char *dst, const unsigned char *src, int size, int check, uint32_t *crc);
+
+// Desfaz o stuffing de size bytes de src para dst (como destuff_bytes) e acumula no registo *crc o campo de
+// verificação dos bytes escritos em dst na mesma passagem.
+// Retorna o número de bytes escritos em dst.
+int destuff_bytes_check(unsigned char *dst, const unsigned char *src, int size, int check, uint32_t *crc);
+
+// Implementações disponíveis do CRC-32C (registo sem a inversão final)
+uint32_t crc32c_slicing8(uint32_t crc, const unsigned char *data, int size);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHECK_X86 1
+
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, int size);
+#endif
+
+#endif // _FRAME_CHECK_H_
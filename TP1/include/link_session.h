@@ -0,0 +1,65 @@
+// Link layer session header
+
+#ifndef _LINK_SESSION_H_
+#define _LINK_SESSION_H_
+
+#include "link_layer.h"
+
+// Sessão da camada de ligação: porta série, parâmetros acordados, janelas, buffers e estatísticas.
+// Cada sessão é independente, por isso um processo pode servir várias portas ao mesmo tempo
+// (uma sessão só pode ser usada por uma thread de cada vez).
+typedef struct LinkSession LinkSession;
+
+// Abre uma ligação com os parâmetros dados.
+// Retorna a nova sessão ou NULL em caso de erro.
+LinkSession *llopen_session(LinkLayer connectionParameters);
+
+// Envia os dados em buf com tamanho bufSize.
+// Retorna o número de caracteres escritos ou -1 em caso de erro.
+int llwrite_session(LinkSession *session, const unsigned char *buf, int bufSize);
+
+// Recebe dados para packet (se ainda há tramas enviadas por confirmar, espera primeiro por elas).
+// Retorna o número de caracteres lidos ou -1 em caso de erro.
+int llread_session(LinkSession *session, unsigned char *packet);
+
+// Recebe dados para packet, esperando no máximo timeout_ms milissegundos.
+// Retorna o número de caracteres lidos, 0 se não chegou nada a tempo ou -1 em caso de erro.
+// Também serve para receber no sentido contrário (o llread espera primeiro pela confirmação das tramas enviadas).
+int llread_timeout_session(LinkSession *session, unsigned char *packet, int timeout_ms);
+
+// O mesmo para a ligação aberta com llopen.
+int llread_timeout(unsigned char *packet, int timeout_ms);
+
+// Tamanho máximo dos dados de um llwrite/llread, acordado no llopen.
+// Retorna o tamanho ou -1 se a sessão não estiver aberta.
+int llmax_payload_session(LinkSession *session);
+
+// O mesmo para a ligação aberta com llopen.
+int llmax_payload();
+
+// Tamanho recomendado dos dados do próximo llwrite (no máximo llmax_payload), adaptado pelo emissor
+// à taxa de erros observada. Retorna o tamanho ou -1 se a sessão não estiver aberta.
+int llpayload_size_session(LinkSession *session);
+
+// O mesmo para a ligação aberta com llopen.
+int llpayload_size();
+
+// Quanto esperar por dados do outro lado que ele já devia ter enviado: o tempo que pode levar a entregá-los com
+// todas as retransmissões (o RTO duplica a cada uma). Retorna o tempo em ms ou -1 se a sessão não estiver aberta.
+int llreply_timeout_session(LinkSession *session);
+
+// O mesmo para a ligação aberta com llopen.
+int llreply_timeout();
+
+// Retorna TRUE se o outro lado mandou os parâmetros da ligação no llopen (os antigos não os conhecem),
+// FALSE se não, ou -1 se a sessão não estiver aberta.
+int llnegotiated_session(LinkSession *session);
+
+// O mesmo para a ligação aberta com llopen.
+int llnegotiated();
+
+// Fecha a ligação (com estatísticas se showStatistics == TRUE) e liberta a sessão.
+// Retorna 1 em caso de sucesso ou -1 em caso de erro.
+int llclose_session(LinkSession *session, int showStatistics);
+
+#endif // _LINK_SESSION_H_
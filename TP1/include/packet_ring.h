@@ -0,0 +1,34 @@
+// Packet ring header
+
+#ifndef _PACKET_RING_H_
+#define _PACKET_RING_H_
+
+// Fila circular de pacotes, sem locks, entre uma thread produtora e uma consumidora (SPSC).
+// Tem um número fixo de slots, cada um com espaço para slotSize bytes e o tamanho do pacote.
+// As esperas (fila cheia / vazia) fazem sched_yield e depois pequenos sleeps.
+typedef struct PacketRing PacketRing;
+
+// Cria uma fila com slots (potência de 2) slots de slotSize bytes.
+// Retorna a fila ou NULL em caso de erro.
+PacketRing *ring_create(int slots, int slotSize);
+
+// Liberta a fila (as duas threads já não a podem estar a usar).
+void ring_destroy(PacketRing *ring);
+
+// Produtor: espera por um slot livre e retorna o seu buffer, ou NULL se a fila foi cancelada.
+unsigned char *ring_reserve(PacketRing *ring);
+
+// Produtor: publica o slot reservado com o tamanho size (o significado de tamanhos <= 0 é de quem usa a fila).
+void ring_publish(PacketRing *ring, int size);
+
+// Consumidor: espera pelo próximo pacote e retorna o seu buffer (com o tamanho em *size),
+// ou NULL se a fila foi cancelada.
+unsigned char *ring_peek(PacketRing *ring, int *size);
+
+// Consumidor: liberta o slot do pacote obtido com ring_peek.
+void ring_release(PacketRing *ring);
+
+// Cancela a fila (por qualquer das threads): as esperas passam a retornar NULL.
+void ring_cancel(PacketRing *ring);
+
+#endif // _PACKET_RING_H_
@@ -0,0 +1,27 @@
+// Reed-Solomon FEC header
+
+#ifndef _REED_SOLOMON_H_
+#define _REED_SOLOMON_H_
+
+// Código Reed-Solomon sobre GF(2^8) em blocos de até RS_BLOCK_SIZE bytes: cada bloco leva até
+// RS_BLOCK_SIZE - parity bytes de dados seguidos de parity bytes de paridade e corrige até parity / 2
+// bytes errados (qualquer número de bits dentro de cada byte). O último bloco é encurtado.
+#define RS_BLOCK_SIZE 255
+#define RS_MAX_PARITY 64
+
+// Tamanho codificado de size bytes de dados.
+int rs_encoded_size(int size, int parity);
+
+// Tamanho dos dados contidos em size bytes codificados (um último bloco sem dados conta como vazio).
+int rs_decoded_size(int size, int parity);
+
+// Codifica size bytes de data para out (com espaço para rs_encoded_size(size, parity) bytes).
+// Retorna o número de bytes escritos em out.
+int rs_encode(unsigned char *out, const unsigned char *data, int size, int parity);
+
+// Descodifica size bytes codificados de coded para out (rs_decoded_size(size, parity) bytes), corrigindo os erros.
+// Um bloco que não se consegue corrigir é copiado tal como chegou.
+// Retorna o número de bytes corrigidos, ou -1 se algum bloco não se conseguiu corrigir.
+int rs_decode(unsigned char *out, const unsigned char *coded, int size, int parity);
+
+#endif // _REED_SOLOMON_H_
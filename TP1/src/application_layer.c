@@ -1,15 +1,28 @@
 // Application layer protocol implementation
 
+// offsets de 64 bits (fseeko/ftello) também em sistemas de 32 bits
+#define _FILE_OFFSET_BITS 64
+
 #include "application_layer.h"
+#include "file_digest.h"
 #include "link_layer.h"
+#include "link_session.h"
+#include "packet_ring.h"
 
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <signal.h>
@@ -18,13 +31,71 @@
 #define START 0x02
 #define END 0x03
 #define DATA 0x01
+#define DATA_JUMBO 0x04 // data packet com tamanho k = L2 * 256 + L1
+#define SESSION_END 0x05 // fim de um lote de ficheiros (só o byte de controlo), antes do DISC
+#define RESUME 0x06 // confirma ao recetor a posição da resposta ao START (TLV_RESUME), antes dos dados de uma retoma
 
 // tipos de TLV
 #define TLV_SIZE 0x00 
 #define TLV_NAME 0x01 
+#define TLV_RESUME 0x02 // posição onde retomar a transferência (só no START)
+#define TLV_BATCH 0x03 // sem valor: o ficheiro faz parte de um lote, podem vir mais na mesma ligação
+#define TLV_PATH 0x04 // pasta do ficheiro dentro da árvore enviada (relativa, separada por '/', vazia no topo)
+#define TLV_MODE 0x05 // permissões do ficheiro ou da pasta (bits 0777)
+#define TLV_DIRECTORY 0x06 // sem valor: a entrada é uma pasta (não há DATA nem END)
+#define TLV_DIGEST 0x07 // algoritmo do digest do ficheiro (1 byte) e, só no END, o digest
+
+// o tamanho do ficheiro vai em big-endian com 4 a 8 bytes (4 é o formato antigo, até 4 GiB)
+#define MIN_SIZE_LENGTH 4
+#define MAX_SIZE_LENGTH 8
+
+// cabeçalho dos data packets (controlo, L2 e L1); o tamanho máximo dos pacotes é acordado no llopen
+#define DATA_PACKET_HEADER_SIZE 3
+
+// maior tamanho de dados com k = L2 * 64 + L1 (DATA); acima disto usa-se DATA_JUMBO, que só chega a recetores
+// que acordaram tramas desse tamanho no llopen (os antigos ficam pelos 505 bytes)
+#define MAX_DATA_SIZE (255 * 64 + 63)
+#define MAX_JUMBO_DATA_SIZE 0xFFFF
+
+// o emissor lê o ficheiro com mmap (readahead sequencial) e constrói os pacotes diretamente a partir do
+// mapeamento, sem a cópia do fread; se o mmap falhar usa fread
+#define MMAP_SOURCE TRUE
+
+// pacotes que a thread de leitura do emissor pode ter prontos à frente do llwrite (potência de 2)
+#define READ_AHEAD_PACKETS 16
+
+// pacotes recebidos (já confirmados) que podem esperar pela thread de escrita do recetor (potência de 2)
+#define WRITE_QUEUE_PACKETS 16
+
+// o recetor junta os dados recebidos neste buffer e escreve-os com um só pwrite na posição certa do
+// ficheiro (tem de caber pelo menos um pacote jumbo)
+#define WRITE_BUFFER_SIZE (256 * 1024)
+
+// transferências retomáveis: o emissor pede no START a posição onde retomar, o recetor responde com um START
+// com os bytes seguidos que já tem (guardados num checkpoint ao lado do ficheiro, atualizado no máximo a cada
+// CHECKPOINT_INTERVAL_MS) e o emissor continua daí. Um recetor antigo não responde e começa-se do início
+#define RESUME_TRANSFERS TRUE
+#define CHECKPOINT_INTERVAL_MS 1000
+#define CHECKPOINT_SUFFIX ".resume"
+#define PATH_MAX_LENGTH 4096
+
+// lotes: se o ficheiro do emissor for uma pasta (os ficheiros dela) ou "@lista" (um caminho por linha), vão
+// todos na mesma ligação, cada um com START/DATA/END e no fim um SESSION_END. O recetor guarda-os na pasta
+// que lhe é dada. O recetor confirma que aceita lotes na resposta ao START
+#define LIST_FILE_PREFIX '@'
+
+// árvores: se o ficheiro do emissor for uma pasta, as subpastas também vão, pela ordem em que são percorridas
+// (cada pasta antes do que tem dentro). Cada entrada leva no START a pasta onde está (TLV_PATH) e as permissões
+// (TLV_MODE), e as pastas vão só com o START (TLV_DIRECTORY). O recetor recria a árvore à medida que a recebe,
+// sem nenhum arquivo intermédio, e confirma que aceita árvores devolvendo as permissões na resposta ao START.
+// Os links simbólicos e os ficheiros especiais não são enviados
+#define MAX_TREE_PATH 255
 
-// maximo payload size para os data packets 
-#define MAX_PACKET_DATA_SIZE 502 // 512 - 6 (cabeçalho e rodapé) - 3 (controlo e L2 e L1) - 1 (só por garantia)
+// verificação de ponta a ponta: o START diz qual o algoritmo e o END leva o digest do ficheiro inteiro, que o
+// recetor compara com o que calculou. O emissor calcula-o na thread de leitura e o recetor na de escrita, por isso
+// não atrasa a linha (numa retoma os bytes que já lá estavam são lidos outra vez antes de continuar).
+// DIGEST_SHA256 para também detetar alterações intencionais, DIGEST_NONE para não verificar
+#define DIGEST_ALGORITHM DIGEST_XXH64
 
 // maximo tamanho de um nome de ficheiro
 #define MAX_FILENAME 494 // MAX_CONTROL_PACKET_SIZE - 1 (controlo) - 1 (TLV_SIZE) - 4 (TLV size length) -  1 (TLV_NAME) - 1 (TLV name length) - 2 (só por garantia)
@@ -41,59 +112,175 @@ void printArray(const unsigned char *array, int length) {
     printf("\n");
 }
 
+// escreve o tamanho (L) e o valor (V) de um TLV numérico, em big-endian com o mínimo de bytes (pelo menos minLen)
+// retorna o número de bytes escritos
+int putNumber(unsigned char *packet, long long value, int minLen) {
+    int len = minLen;
+    while (len < MAX_SIZE_LENGTH && (value >> (8 * len)) != 0) {
+        len++;
+    }
+
+    int index = 0;
+    packet[index] = len;
+    index++;
+    for (int i = len - 1; i >= 0; i--) {
+        packet[index] = (value >> (8 * i)) & 0xFF;
+        index++;
+    }
+    return index;
+}
+
+// lê o valor de um TLV numérico com len bytes em big-endian
+long long getNumber(const unsigned char *value, int len) {
+    unsigned long long number = 0;
+    for (int i = 0; i < len; i++) {
+        number = (number << 8) | value[i];
+    }
+    return (long long)number;
+}
+
+// conteúdo de um pacote de controlo START ou END
+typedef struct {
+    int type;                        // START ou END
+    long long fileSize;
+    char fileName[MAX_FILENAME + 1];
+    long long resumeOffset;          // posição onde retomar, -1 se não vem no pacote
+    int batch;                       // TRUE se o ficheiro faz parte de um lote
+    char path[MAX_TREE_PATH + 1];    // pasta dentro da árvore (só com mode >= 0)
+    int mode;                        // permissões numa árvore, -1 se não vêm no pacote
+    int directory;                   // TRUE se a entrada da árvore é uma pasta
+    int digestAlgorithm;             // DIGEST_NONE se não vem no pacote
+    unsigned char digest[DIGEST_MAX_SIZE];
+    int digestSize;                  // 0 no START
+} ControlPacket;
+
 // constroi o pacote de controlo START ou END
 // retorna o tamanho do pacote, ou -1 se ocorrer algum erro
-int buildControlPacket(int controlType, long fileSize, const char *fileName, unsigned char *packet) {
-    int fileNameLen = strlen(fileName);
+int buildControlPacket(const ControlPacket *control, unsigned char *packet) {
+    int fileNameLen = strlen(control->fileName);
     if (fileNameLen > MAX_FILENAME) {
         printf("Error: file name too long.\n");
         return -1;
     }
+    int pathLen = strlen(control->path);
+    if (control->mode >= 0 && pathLen > MAX_TREE_PATH) {
+        printf("Error: path too long.\n");
+        return -1;
+    }
+
+    // o pacote tem de caber no tamanho mínimo acordado pelo llopen (controlo, TLVs e valores de 8 bytes no máximo)
+    int maxSize = 1 + 2 + MAX_SIZE_LENGTH + 2 + fileNameLen;
+    if (control->resumeOffset >= 0) maxSize += 2 + MAX_SIZE_LENGTH;
+    if (control->batch) maxSize += 2;
+    if (control->mode >= 0) maxSize += 2 + pathLen + 2 + 2 + (control->directory ? 2 : 0);
+    if (control->digestAlgorithm != DIGEST_NONE) maxSize += 2 + 1 + control->digestSize;
+    if (maxSize > MAX_CONTROL_PACKET_SIZE) {
+        printf("Error: control packet too large.\n");
+        return -1;
+    }
    
     int index = 0;
-    packet[index] = controlType;  // START ou END
+    packet[index] = control->type;  // START ou END
     index++;
     
     packet[index] = TLV_SIZE; // TLV_SIZE
     index++;
-    packet[index] = 4;  // tamanho do tamanho do ficheiro         
-    index++;
-    // tamanho do ficheiro em 4 bytes em big-endian
-    packet[index] = (fileSize >> 24) & 0xFF; 
-    index++;
-    packet[index] = (fileSize >> 16) & 0xFF; 
-    index++;
-    packet[index] = (fileSize >> 8) & 0xFF; 
-    index++;
-    packet[index] = fileSize & 0xFF; 
-    index++;
+    // tamanho do ficheiro em big-endian (no mínimo 4 bytes, para os recetores antigos)
+    index += putNumber(&packet[index], control->fileSize, MIN_SIZE_LENGTH);
    
     packet[index] = TLV_NAME;  // TLV_NAME
     index++;
     packet[index] = fileNameLen; // tamanho do nome do ficheiro    
     index++;
-    memcpy(&packet[index], fileName, fileNameLen); // nome do ficheiro
+    memcpy(&packet[index], control->fileName, fileNameLen); // nome do ficheiro
     index += fileNameLen;
 
+    // os recetores antigos ignoram o que vem depois do nome
+    if (control->resumeOffset >= 0) {
+        packet[index] = TLV_RESUME;
+        index++;
+        index += putNumber(&packet[index], control->resumeOffset, 1);
+    }
+    if (control->batch) {
+        packet[index] = TLV_BATCH;
+        index++;
+        packet[index] = 0;
+        index++;
+    }
+    if (control->mode >= 0) {
+        packet[index] = TLV_PATH;
+        index++;
+        packet[index] = pathLen;
+        index++;
+        memcpy(&packet[index], control->path, pathLen);
+        index += pathLen;
+
+        packet[index] = TLV_MODE;
+        index++;
+        packet[index] = 2;
+        index++;
+        packet[index] = (control->mode >> 8) & 0xFF;
+        index++;
+        packet[index] = control->mode & 0xFF;
+        index++;
+
+        if (control->directory) {
+            packet[index] = TLV_DIRECTORY;
+            index++;
+            packet[index] = 0;
+            index++;
+        }
+    }
+    if (control->digestAlgorithm != DIGEST_NONE) {
+        packet[index] = TLV_DIGEST;
+        index++;
+        packet[index] = 1 + control->digestSize;
+        index++;
+        packet[index] = control->digestAlgorithm;
+        index++;
+        memcpy(&packet[index], control->digest, control->digestSize);
+        index += control->digestSize;
+    }
+
     return index;
 }
 
-// constroi o pacote de dados
-// retorna o tamanho do pacote
-int buildDataPacket(const unsigned char *data, int dataSize, unsigned char *packet) {
+// escreve o cabeçalho do pacote de dados (controlo, L2 e L1) para dataSize bytes de dados
+// retorna o tamanho do cabeçalho, ou -1 se ocorrer algum erro
+int buildDataPacketHeader(int dataSize, unsigned char *packet) {
     int index = 0;
-    if(dataSize > MAX_PACKET_DATA_SIZE) {
+    if(dataSize > MAX_JUMBO_DATA_SIZE) {
         printf("Error: data packet size too large.\n");
         return -1;
     }
-    packet[index] = DATA; 
-    index++;
 
-    // k = L2 * 64 + L1, como temos pacotes de tamanho máximo 502, não faz sentido utilizar 256 como diz nos slides
-    packet[index] = (dataSize / 64);  
-    index++;
-    packet[index] = (dataSize % 64);        
-    index++;
+    if (dataSize > MAX_DATA_SIZE) {
+        // jumbo: k = L2 * 256 + L1
+        packet[index] = DATA_JUMBO;
+        index++;
+        packet[index] = (dataSize >> 8) & 0xFF;
+        index++;
+        packet[index] = dataSize & 0xFF;
+        index++;
+    } else {
+        packet[index] = DATA; 
+        index++;
+
+        // k = L2 * 64 + L1 (até 255 * 64 + 63 bytes de dados)
+        packet[index] = (dataSize / 64);  
+        index++;
+        packet[index] = (dataSize % 64);        
+        index++;
+    }
+    return index;
+}
+
+// constroi o pacote de dados
+// retorna o tamanho do pacote
+int buildDataPacket(const unsigned char *data, int dataSize, unsigned char *packet) {
+    int index = buildDataPacketHeader(dataSize, packet);
+    if (index < 0)
+        return -1;
 
     memcpy(&packet[index], data, dataSize);
 
@@ -103,13 +290,13 @@ int buildDataPacket(const unsigned char *data, int dataSize, unsigned char *pack
 
 // interpreta o pacote de controlo
 // retorna 0 em caso de sucesso, -1 se ocorrer algum erro
-int parseControlPacket(const unsigned char *packet, int packetSize, int *controlType, long *fileSize, char *fileNameOut) {
-    // tamanho mínimo de um pacote de controlo, que são os C (1), T1(1), L1(1), V1(4), T2(1), L2(1) 
-    if (packetSize < 9)
+int parseControlPacket(const unsigned char *packet, int packetSize, ControlPacket *control) {
+    // tamanho mínimo de um pacote de controlo, que são os C (1), T1(1), L1(1), V1(1 a 8), T2(1), L2(1) 
+    if (packetSize < 6)
         return -1;
     
     int index = 0;
-    *controlType = packet[index];   //verifica se é START ou END
+    control->type = packet[index];   //verifica se é START ou END
     
     index++; 
 
@@ -119,33 +306,117 @@ int parseControlPacket(const unsigned char *packet, int packetSize, int *control
     index++;
     int len = packet[index]; 
     index++;
-    if (len != 4 || index + 4 > packetSize) //verifica se o tamanho é 4 e se não ultrapassa o tamanho do pacote
+    if (len < 1 || len > MAX_SIZE_LENGTH || index + len + 2 > packetSize) //verifica se o tamanho tem 1 a 8 bytes e se não ultrapassa o tamanho do pacote
         return -1;
     
-    int temp1 = packet[index] << 24; 
-    index++;
-    int temp2 = packet[index] << 16;
-    index++;
-    int temp3 = packet[index] << 8;
-    index++;
-    int temp4 = packet[index];
-    index++;
-    
-    *fileSize = (temp1) | (temp2) | (temp3) | (temp4); // junta os 4 bytes para obter o tamanho do ficheiro
+    // junta os len bytes (big-endian) para obter o tamanho do ficheiro
+    control->fileSize = getNumber(&packet[index], len);
+    index += len;
 
     if (packet[index] != TLV_NAME) //verifica se é TLV_NAME
         return -1;
     index++;
     int nameLen = packet[index]; 
-    if (nameLen <= 0 || nameLen > MAX_FILENAME || index + nameLen > packetSize) //verifica se o tamanho do nome é válido
+    if (nameLen <= 0 || nameLen > MAX_FILENAME || index + 1 + nameLen > packetSize) //verifica se o tamanho do nome é válido
         return -1;
 
     index++;
-    memcpy(fileNameOut, &packet[index], nameLen); //copia o nome do ficheiro
-    fileNameOut[nameLen] = '\0'; //adiciona o terminador de string
+    memcpy(control->fileName, &packet[index], nameLen); //copia o nome do ficheiro
+    control->fileName[nameLen] = '\0'; //adiciona o terminador de string
+    index += nameLen;
+
+    // TLVs opcionais (os desconhecidos são ignorados)
+    control->resumeOffset = -1;
+    control->batch = FALSE;
+    control->path[0] = '\0';
+    control->mode = -1;
+    control->directory = FALSE;
+    control->digestAlgorithm = DIGEST_NONE;
+    control->digestSize = 0;
+    while (index + 2 <= packetSize) {
+        int type = packet[index];
+        len = packet[index + 1];
+        index += 2;
+        if (index + len > packetSize)
+            return -1;
+        if (type == TLV_RESUME && len >= 1 && len <= MAX_SIZE_LENGTH)
+            control->resumeOffset = getNumber(&packet[index], len);
+        if (type == TLV_BATCH)
+            control->batch = TRUE;
+        if (type == TLV_PATH && len <= MAX_TREE_PATH) {
+            memcpy(control->path, &packet[index], len);
+            control->path[len] = '\0';
+        }
+        if (type == TLV_MODE && len >= 1 && len <= 4)
+            control->mode = getNumber(&packet[index], len) & 0777;
+        if (type == TLV_DIRECTORY)
+            control->directory = TRUE;
+        if (type == TLV_DIGEST && len >= 1 && len <= 1 + DIGEST_MAX_SIZE) {
+            control->digestAlgorithm = packet[index];
+            control->digestSize = len - 1;
+            memcpy(control->digest, &packet[index + 1], len - 1);
+        }
+        index += len;
+    }
     return 0;
 }
 
+////////////////////////////////////////////////
+// CHECKPOINT
+////////////////////////////////////////////////
+// O checkpoint de "ficheiro" é "ficheiro.resume", com o tamanho, os bytes seguidos já escritos e o nome
+// anunciado no START
+
+// caminho do checkpoint do ficheiro filename
+void checkpointPath(const char *filename, char *path, int size) {
+    snprintf(path, size, "%s%s", filename, CHECKPOINT_SUFFIX);
+}
+
+// retorna os bytes seguidos do ficheiro filename que já foram recebidos numa transferência anterior do mesmo
+// ficheiro (mesmo nome e tamanho), ou 0 se não há checkpoint válido
+long long readCheckpoint(const char *filename, long long fileSize, const char *fileName) {
+    char path[PATH_MAX_LENGTH];
+    checkpointPath(filename, path, sizeof(path));
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return 0;
+
+    long long size, offset;
+    char name[MAX_FILENAME + 1];
+    int fields = fscanf(fp, "%lld %lld %494[^\n]", &size, &offset, name);
+    fclose(fp);
+    if (fields != 3 || size != fileSize || strcmp(name, fileName) != 0 || offset < 0 || offset > fileSize)
+        return 0;
+
+    // o ficheiro tem de ter pelo menos esses bytes
+    struct stat st;
+    if (stat(filename, &st) < 0 || st.st_size < offset)
+        return 0;
+    return offset;
+}
+
+// guarda no checkpoint os bytes seguidos já escritos (num ficheiro temporário renomeado por cima, para que
+// um checkpoint a meio de ser escrito nunca seja lido)
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int writeCheckpoint(const char *filename, long long fileSize, const char *fileName, long long offset) {
+    char path[PATH_MAX_LENGTH], tmpPath[PATH_MAX_LENGTH + 4];
+    checkpointPath(filename, path, sizeof(path));
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *fp = fopen(tmpPath, "w");
+    if (!fp)
+        return -1;
+    fprintf(fp, "%lld %lld %s\n", fileSize, offset, fileName);
+    if (fclose(fp) != 0)
+        return -1;
+    return rename(tmpPath, path);
+}
+
+// apaga o checkpoint do ficheiro filename (transferência completa)
+void removeCheckpoint(const char *filename) {
+    char path[PATH_MAX_LENGTH];
+    checkpointPath(filename, path, sizeof(path));
+    unlink(path);
+}
 
 // Returns 0 on success, -1 on error.
 int parseDataPacket(const unsigned char *packet, int packetSize, int *dataSizeOut, unsigned char *dataOut) {
@@ -153,15 +424,16 @@ int parseDataPacket(const unsigned char *packet, int packetSize, int *dataSizeOu
         return -1;
     
     int index = 0;
-    if (packet[index] != DATA)
+    if (packet[index] != DATA && packet[index] != DATA_JUMBO)
         return -1;
+    int jumbo = (packet[index] == DATA_JUMBO);
     index++;
     
     int L2 = packet[index]; // L2
     index++;
     int L1 = packet[index]; // L1
     index++;
-    int payloadSize = L2 * 64 + L1;
+    int payloadSize = jumbo ? L2 * 256 + L1 : L2 * 64 + L1;
     
     if (index + payloadSize > packetSize)
         return -1;
@@ -171,6 +443,789 @@ int parseDataPacket(const unsigned char *packet, int packetSize, int *dataSizeOu
     return 0;
 }
 
+// escreve size bytes de buf na posição offset do ficheiro (o pwrite pode escrever só uma parte)
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int writeAt(int fd, const unsigned char *buf, int size, long long offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if (n < 0)
+            return -1;
+        buf += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// acrescenta ao digest os primeiros size bytes do ficheiro fd (o que já tinha sido transferido, numa retoma)
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int digestPrefix(FileDigest *digest, int fd, long long size) {
+    unsigned char buf[64 * 1024];
+    long long offset = 0;
+    while (offset < size) {
+        int chunk = (size - offset < (long long)sizeof(buf)) ? (int)(size - offset) : (int)sizeof(buf);
+        ssize_t n = pread(fd, buf, chunk, offset);
+        if (n <= 0)
+            return -1;
+        digest_update(digest, buf, n);
+        offset += n;
+    }
+    return 0;
+}
+
+// tempo decorrido (em milissegundos) desde o instante dado
+double elapsedMs(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1E3 + (now.tv_nsec - since->tv_nsec) / 1E6;
+}
+
+// imprime a barra de progresso
+void printProgress(long long done, long long total) {
+    const int barWidth = 50;
+    int percent = total ? (int)((done * 100) / total) : 100;
+    printf("\r["); 
+    int pos = (percent * barWidth) / 100;
+    for (int i = 0; i < barWidth; i++) {
+        if (i < pos)
+            printf("*");
+        else
+            printf(" ");
+    }
+    printf("] %d%%", percent);
+    fflush(stdout);
+}
+
+// estado partilhado entre o emissor e a thread que lê o ficheiro
+typedef struct {
+    PacketRing *ring;
+    FILE *fp;
+    const unsigned char *fileMap; // NULL se o ficheiro é lido com fread
+    long long fileSize;
+    long long offset; // posição onde começar (retoma)
+    atomic_int dataSize; // tamanho dos dados recomendado pela camada de ligação, atualizado pelo emissor
+    FileDigest digest; // do ficheiro inteiro, para o END (o emissor só o lê depois do join)
+} FileReader;
+
+// thread que lê o ficheiro e constrói os data packets na fila, à frente do llwrite, para que uma leitura
+// lenta do disco não pare a linha série.
+// No fim do ficheiro publica um pacote de tamanho 0 (ou -1 se a leitura falhar)
+void *readerThread(void *arg) {
+    FileReader *reader = arg;
+    long long offset = reader->offset;
+
+    // numa retoma o digest também cobre o que já tinha sido enviado
+    if (reader->digest.algorithm != DIGEST_NONE && offset > 0) {
+        if (reader->fileMap)
+            digest_update(&reader->digest, reader->fileMap, offset);
+        else if (digestPrefix(&reader->digest, fileno(reader->fp), offset) < 0) {
+            if (ring_reserve(reader->ring) != NULL)
+                ring_publish(reader->ring, -1);
+            return NULL;
+        }
+    }
+
+    while (1) {
+        unsigned char *packet = ring_reserve(reader->ring);
+        if (packet == NULL)
+            return NULL; // o emissor desistiu
+
+        int dataSize = atomic_load_explicit(&reader->dataSize, memory_order_relaxed);
+        int bytesRead;
+        if (reader->fileMap) {
+            // os dados vêm diretamente do mapeamento
+            bytesRead = (reader->fileSize - offset < dataSize) ? (int)(reader->fileSize - offset) : dataSize;
+            if (bytesRead > 0) {
+                buildDataPacket(&reader->fileMap[offset], bytesRead, packet);
+                digest_update(&reader->digest, &packet[DATA_PACKET_HEADER_SIZE], bytesRead);
+            }
+        } else {
+            // o fread escreve logo a seguir ao cabeçalho
+            bytesRead = fread(&packet[DATA_PACKET_HEADER_SIZE], 1, dataSize, reader->fp);
+            if (bytesRead > 0) {
+                buildDataPacketHeader(bytesRead, packet);
+                digest_update(&reader->digest, &packet[DATA_PACKET_HEADER_SIZE], bytesRead);
+            }
+            else if (ferror(reader->fp))
+                bytesRead = -1;
+        }
+
+        if (bytesRead <= 0) {
+            ring_publish(reader->ring, bytesRead);
+            return NULL;
+        }
+        offset += bytesRead;
+        ring_publish(reader->ring, DATA_PACKET_HEADER_SIZE + bytesRead);
+    }
+}
+
+// estado partilhado entre o recetor e a thread que escreve o ficheiro
+typedef struct {
+    PacketRing *ring;
+    int fd;
+    const char *filename;
+    const char *fileName; // nome anunciado no START (guardado no checkpoint)
+    long long fileSize;
+    long long offset; // posição onde começar (retoma)
+    int maxDataSize;
+    long long totalBytesReceived;
+    int error;
+    FileDigest digest; // do ficheiro inteiro, comparado com o do END (DIGEST_NONE se o START não tem)
+} FileWriter;
+
+// thread que escreve o ficheiro com os pacotes que o recetor põe na fila, para que a confirmação das tramas
+// não espere pelo disco. Termina no pacote END, ou num pacote de tamanho -1 (o llread falhou)
+void *writerThread(void *arg) {
+    FileWriter *writer = arg;
+    int buffered = 0;
+    long long offset = writer->offset;
+    struct timespec lastCheckpoint;
+    clock_gettime(CLOCK_MONOTONIC, &lastCheckpoint);
+
+    // os dados vão diretamente para o buffer de escrita, na posição offset do ficheiro
+    unsigned char *writeBuffer = malloc(WRITE_BUFFER_SIZE);
+    if (!writeBuffer) {
+        printf("Error allocating write buffer\n");
+        writer->error = 1;
+        ring_cancel(writer->ring);
+        return NULL;
+    }
+
+    // numa retoma o digest também cobre o que já estava no ficheiro
+    int corrupted = FALSE;
+    if (writer->digest.algorithm != DIGEST_NONE && offset > 0 && digestPrefix(&writer->digest, writer->fd, offset) < 0) {
+        printf("Error reading file %s\n", writer->filename);
+        writer->error = 1;
+        ring_cancel(writer->ring);
+    }
+
+    unsigned char *packet;
+    int packetSize;
+    while ((packet = ring_peek(writer->ring, &packetSize)) != NULL) {
+        if (packetSize < 0) {
+            writer->error = 1;
+            break;
+        }
+
+        int packetType = packet[0];
+        // verifica se é um pacote de dados
+        if (packetType == DATA || packetType == DATA_JUMBO) {
+            // escreve o buffer se o próximo pacote pode não caber ou se está na hora de um checkpoint
+            int checkpointDue = RESUME_TRANSFERS && buffered > 0 && elapsedMs(&lastCheckpoint) >= CHECKPOINT_INTERVAL_MS;
+            if (buffered + writer->maxDataSize > WRITE_BUFFER_SIZE || checkpointDue) {
+                if (writeAt(writer->fd, writeBuffer, buffered, offset) < 0) {
+                    printf("Error writing file %s\n", writer->filename);
+                    writer->error = 1;
+                    break;
+                }
+                offset += buffered;
+                buffered = 0;
+
+                // o checkpoint só conta bytes que já estão no disco
+                if (checkpointDue) {
+                    if (fdatasync(writer->fd) < 0 || writeCheckpoint(writer->filename, writer->fileSize, writer->fileName, offset) < 0)
+                        printf("\nWarning: could not write checkpoint\n");
+                    clock_gettime(CLOCK_MONOTONIC, &lastCheckpoint);
+                }
+            }
+
+            int payloadSize;
+            if (parseDataPacket(packet, packetSize, &payloadSize, &writeBuffer[buffered]) < 0) {
+                printf("Error parsing data packet\n");
+                writer->error = 1;
+                break;
+            }
+            ring_release(writer->ring);
+            digest_update(&writer->digest, &writeBuffer[buffered], payloadSize);
+            buffered += payloadSize;
+            writer->totalBytesReceived += payloadSize;
+            printProgress(writer->totalBytesReceived, writer->fileSize);
+        }
+        else if (packetType == END) {
+            // verifica se é o pacote END
+            ControlPacket end;
+            if (parseControlPacket(packet, packetSize, &end) < 0 || end.type != END) {
+                printf("Error parsing END packet\n");
+                writer->error = 1;
+                break;
+            }
+            ring_release(writer->ring);
+            printf("\nEND packet received\n");
+
+            // compara o digest do ficheiro recebido com o do emissor
+            if (writer->digest.algorithm != DIGEST_NONE) {
+                unsigned char digest[DIGEST_MAX_SIZE];
+                int digestSize = digest_final(&writer->digest, digest);
+                const char *name = digest_name(writer->digest.algorithm);
+                if (end.digestAlgorithm != writer->digest.algorithm || end.digestSize != digestSize) {
+                    printf("Warning: END packet without the %s digest, file not verified\n", name);
+                } else if (memcmp(digest, end.digest, digestSize) != 0) {
+                    printf("Error: %s digest mismatch, file %s is corrupted\n", name, writer->filename);
+                    writer->error = 1;
+                    corrupted = TRUE;
+                } else {
+                    printf("File verified (%s)\n", name);
+                }
+            }
+            break;
+        }
+        else {
+            ring_release(writer->ring);
+        }
+    }
+
+    // o recetor deixa de ler se esta thread parou por erro
+    if (writer->error)
+        ring_cancel(writer->ring);
+
+    // escreve o que falta (também em caso de erro, como antes) e corta o espaço reservado a mais
+    // (se vieram menos bytes do que o anunciado)
+    if (writeAt(writer->fd, writeBuffer, buffered, offset) < 0 || ftruncate(writer->fd, offset + buffered) < 0) {
+        printf("Error writing file %s\n", writer->filename);
+        writer->error = 1;
+    }
+    else if (RESUME_TRANSFERS) {
+        // completo: o checkpoint já não é preciso; incompleto: guarda até onde chegou para retomar daí;
+        // corrompido: não se pode retomar, da próxima vez vem tudo
+        if (!writer->error || corrupted)
+            removeCheckpoint(writer->filename);
+        else if (fdatasync(writer->fd) < 0 || writeCheckpoint(writer->filename, writer->fileSize, writer->fileName, offset + buffered) < 0)
+            printf("\nWarning: could not write checkpoint\n");
+    }
+    free(writeBuffer);
+    return NULL;
+}
+
+// nome do ficheiro sem a pasta
+const char *baseName(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+void freeFiles(char **files, int count) {
+    for (int i = 0; i < count; i++)
+        free(files[i]);
+    free(files);
+}
+
+// acrescenta path à lista de ficheiros
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int appendFile(char ***files, int *count, const char *path) {
+    char **grown = realloc(*files, (*count + 1) * sizeof(char *));
+    if (!grown)
+        return -1;
+    *files = grown;
+    (*files)[*count] = strdup(path);
+    if (!(*files)[*count])
+        return -1;
+    (*count)++;
+    return 0;
+}
+
+// pasta recebida numa árvore, com as permissões a dar-lhe no fim
+typedef struct {
+    char *path;
+    int mode;
+} ReceivedDirectory;
+
+// acrescenta a pasta path, com as permissões mode, à lista das pastas recebidas (tudo ou nada: se falhar a
+// lista fica como estava)
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int appendDirectory(ReceivedDirectory **directories, int *count, const char *path, int mode) {
+    ReceivedDirectory *grown = realloc(*directories, (*count + 1) * sizeof(ReceivedDirectory));
+    if (!grown)
+        return -1;
+    *directories = grown;
+    char *copy = strdup(path);
+    if (!copy)
+        return -1;
+    grown[*count].path = copy;
+    grown[*count].mode = mode;
+    (*count)++;
+    return 0;
+}
+
+// acrescenta à lista as entradas da pasta dir (por ordem alfabética, cada subpasta seguida do que tem dentro):
+// só ficheiros regulares e pastas, sem seguir links simbólicos
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int walkTree(const char *dir, char ***files, int *count) {
+    struct dirent **entries;
+    int n = scandir(dir, &entries, NULL, alphasort);
+    if (n < 0) {
+        printf("Error reading directory %s\n", dir);
+        return -1;
+    }
+
+    int error = 0;
+    for (int i = 0; i < n; i++) {
+        const char *name = entries[i]->d_name;
+        char path[PATH_MAX_LENGTH];
+        struct stat st;
+        if (error || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            free(entries[i]);
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (lstat(path, &st) < 0) {
+            printf("Error reading %s\n", path);
+        } else if (S_ISREG(st.st_mode)) {
+            error = appendFile(files, count, path);
+        } else if (S_ISDIR(st.st_mode)) {
+            // uma subpasta que não se consegue ler vai vazia
+            error = appendFile(files, count, path);
+            if (!error)
+                walkTree(path, files, count);
+        } else {
+            printf("Skipping %s (not a regular file or directory)\n", path);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return error ? -1 : 0;
+}
+
+// lista os ficheiros a enviar: a árvore de uma pasta (ficheiros e subpastas), os caminhos de uma lista
+// "@ficheiro" (um por linha) ou só o próprio ficheiro. *batch fica TRUE nos dois primeiros casos, e numa
+// árvore *rootLength é o tamanho do prefixo a tirar aos caminhos para os ter relativos à pasta (senão 0)
+// retorna o número de ficheiros (em *files, libertar com freeFiles), ou -1 se ocorrer algum erro
+int listFiles(const char *arg, char ***files, int *batch, int *rootLength) {
+    int count = 0;
+    *files = NULL;
+    *batch = TRUE;
+    *rootLength = 0;
+
+    if (arg[0] == LIST_FILE_PREFIX) {
+        FILE *list = fopen(arg + 1, "r");
+        if (!list) {
+            printf("Error opening file list %s\n", arg + 1);
+            return -1;
+        }
+        char line[PATH_MAX_LENGTH];
+        while (fgets(line, sizeof(line), list)) {
+            struct stat st;
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            // só ficheiros regulares (uma pasta ou um FIFO não têm tamanho para o START)
+            if (stat(line, &st) < 0) {
+                printf("Error reading %s\n", line);
+                continue;
+            }
+            if (!S_ISREG(st.st_mode)) {
+                printf("Skipping %s (not a regular file)\n", line);
+                continue;
+            }
+            if (appendFile(files, &count, line) < 0)
+                break;
+        }
+        fclose(list);
+        return count;
+    }
+
+    struct stat st;
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (walkTree(arg, files, &count) < 0) {
+            freeFiles(*files, count);
+            return -1;
+        }
+        *rootLength = strlen(arg) + 1;
+        return count;
+    }
+
+    // um só ficheiro: como antes, sem lote
+    *batch = FALSE;
+    *files = malloc(sizeof(char *));
+    if (!*files)
+        return -1;
+    (*files)[count++] = strdup(arg);
+    return count;
+}
+
+// manda o START control e, se o recetor tiver de responder (para retomar ou num lote), lê a resposta para
+// *reply; *replied fica FALSE se não houve resposta, como nos recetores antigos (e *reply não tem nada)
+// retorna 0 em caso de sucesso, 1 se o pacote não se consegue construir (não se enviou nada) ou -1 se ocorrer
+// algum erro
+int sendStart(const ControlPacket *control, ControlPacket *reply, int *replied, int maxPacketSize, int timeout) {
+    memset(reply, 0, sizeof(*reply));
+    *replied = FALSE;
+
+    unsigned char controlPacket[MAX_CONTROL_PACKET_SIZE];
+    int controlPacketSize = buildControlPacket(control, controlPacket);
+    if (controlPacketSize < 0)
+        return 1;
+    if (llwrite(controlPacket, controlPacketSize) < 0) {
+        printf("Error sending START packet\n");
+        return -1;
+    }
+
+    // o recetor responde com um START com a posição onde retomar e o que aceita (os antigos não respondem).
+    // Espera-se mais do que ele pode levar a entregar a resposta com todas as retransmissões: desistir antes
+    // deixava-o a meio de uma retoma que o emissor não conhece
+    if (control->resumeOffset >= 0 || control->batch) {
+        unsigned char replyPacket[maxPacketSize];
+        int waitMs = llnegotiated() == TRUE ? llreply_timeout() : timeout * 1000;
+        struct timespec since;
+        clock_gettime(CLOCK_MONOTONIC, &since);
+        while (!*replied && elapsedMs(&since) < waitMs) {
+            int replySize = llread_timeout(replyPacket, waitMs - (int)elapsedMs(&since));
+            if (replySize < 0) {
+                printf("Error reading START reply\n");
+                return -1;
+            }
+            if (replySize == 0)
+                break;
+            // uma resposta atrasada a um START anterior (outro nome ou tamanho) não é esta
+            if (parseControlPacket(replyPacket, replySize, reply) == 0 && reply->type == START &&
+                reply->fileSize == control->fileSize && strcmp(reply->fileName, control->fileName) == 0)
+                *replied = TRUE;
+        }
+        if (!*replied)
+            memset(reply, 0, sizeof(*reply));
+    }
+    return 0;
+}
+
+// confirma ao recetor que os dados do START control começam em resumeOffset, a posição que ele respondeu
+// (se o RESUME não vier antes dos dados, o recetor recebe o ficheiro desde o início)
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int sendResume(const ControlPacket *control, long long resumeOffset) {
+    ControlPacket resume = *control;
+    resume.type = RESUME;
+    resume.resumeOffset = resumeOffset;
+    resume.batch = FALSE;
+    resume.mode = -1;
+    resume.digestAlgorithm = DIGEST_NONE;
+    unsigned char controlPacket[MAX_CONTROL_PACKET_SIZE];
+    int controlPacketSize = buildControlPacket(&resume, controlPacket);
+    if (controlPacketSize < 0 || llwrite(controlPacket, controlPacketSize) < 0) {
+        printf("Error sending RESUME packet\n");
+        return -1;
+    }
+    return 0;
+}
+
+// constroi e manda o pacote de controlo END do START control (só o tamanho e o nome)
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int sendEnd(const ControlPacket *control) {
+    ControlPacket end = *control;
+    end.type = END;
+    end.resumeOffset = -1;
+    end.batch = FALSE;
+    end.mode = -1;
+    unsigned char controlPacket[MAX_CONTROL_PACKET_SIZE];
+    int controlPacketSize = buildControlPacket(&end, controlPacket);
+    if (controlPacketSize < 0 || llwrite(controlPacket, controlPacketSize) < 0) {
+        printf("\nError sending END packet\n");
+        return -1;
+    }
+    return 0;
+}
+
+// envia o ficheiro path com START/DATA/END, anunciado com o START control (nome e, num lote ou numa árvore,
+// o resto já preenchidos); a resposta do recetor ao START fica em *reply (*replied FALSE se não respondeu)
+// retorna 0 em caso de sucesso, 1 se o ficheiro não abre ou não é um ficheiro regular (não se enviou nada) ou
+// -1 se ocorrer algum erro
+int sendFile(const char *path, ControlPacket *control, ControlPacket *reply, int *replied, int maxPacketSize,
+             int timeout) {
+    // só ficheiros regulares: uma pasta ou um FIFO não têm tamanho (e abrir um FIFO bloqueava)
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        printf("Error opening file %s\n", path);
+        return 1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        printf("Skipping %s (not a regular file)\n", path);
+        return 1;
+    }
+
+    // abrir o ficheiro
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        printf("Error opening file %s\n", path);
+        return 1;
+    }
+    
+    // tamanho do ficheiro (do ficheiro aberto, caso o caminho tenha mudado entretanto)
+    if (fstat(fileno(fp), &st) < 0 || !S_ISREG(st.st_mode)) {
+        printf("Skipping %s (not a regular file)\n", path);
+        fclose(fp);
+        return 1;
+    }
+    long long fileSize = st.st_size;
+    
+    printf("Sending file %s, size = %lld bytes\n", path, fileSize);
+
+    // constroi e manda o control packet
+    control->type = START;
+    control->fileSize = fileSize;
+    control->resumeOffset = RESUME_TRANSFERS ? 0 : -1;
+    control->digestAlgorithm = DIGEST_ALGORITHM;
+    control->digestSize = 0;
+    int result = sendStart(control, reply, replied, maxPacketSize, timeout);
+    if (result != 0) {
+        fclose(fp);
+        return result;
+    }
+
+    // o recetor diz na resposta onde retomar
+    long long resumeOffset = 0;
+    if (RESUME_TRANSFERS && *replied && reply->resumeOffset > 0 && reply->resumeOffset <= fileSize) {
+        resumeOffset = reply->resumeOffset;
+        if (sendResume(control, resumeOffset) < 0) {
+            fclose(fp);
+            return -1;
+        }
+        printf("Resuming at byte %lld\n", resumeOffset);
+        fseeko(fp, resumeOffset, SEEK_SET);
+    }
+    
+    // mapeia o ficheiro inteiro; o kernel faz o readahead porque a leitura é sequencial
+    const unsigned char *fileMap = NULL;
+#if MMAP_SOURCE
+    if (fileSize > 0 && (unsigned long long)fileSize <= SIZE_MAX) {
+        void *map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (map != MAP_FAILED) {
+            madvise(map, fileSize, MADV_SEQUENTIAL);
+            fileMap = map;
+        }
+    }
+#endif
+
+    // a thread de leitura prepara os pacotes; esta só os envia
+    FileReader reader;
+    reader.ring = ring_create(READ_AHEAD_PACKETS, maxPacketSize);
+    reader.fp = fp;
+    reader.fileMap = fileMap;
+    reader.fileSize = fileSize;
+    reader.offset = resumeOffset;
+    atomic_init(&reader.dataSize, llpayload_size() - DATA_PACKET_HEADER_SIZE);
+    digest_init(&reader.digest, DIGEST_ALGORITHM);
+    pthread_t readerId;
+    if (reader.ring == NULL || pthread_create(&readerId, NULL, readerThread, &reader) != 0) {
+        printf("Error starting file reader\n");
+        ring_destroy(reader.ring);
+        if (fileMap)
+            munmap((void *)fileMap, fileSize);
+        fclose(fp);
+        return -1;
+    }
+
+    int packetSize;
+    long long totalSent = resumeOffset; 
+    int error = 0;
+
+    // envia os pacotes pela ordem em que a thread de leitura os pôs na fila
+    // o tamanho de cada pacote é o recomendado pela camada de ligação (adaptado à taxa de erros)
+    unsigned char *dataPacket;
+    while ((dataPacket = ring_peek(reader.ring, &packetSize)) != NULL) {
+        if (packetSize <= 0) {
+            if (packetSize < 0) {
+                printf("Error reading file %s\n", path);
+                error = 1;
+            }
+            break;
+        }
+
+        int written = llwrite(dataPacket, packetSize);
+        ring_release(reader.ring);
+        atomic_store_explicit(&reader.dataSize, llpayload_size() - DATA_PACKET_HEADER_SIZE, memory_order_relaxed);
+        if (written < 0) {
+            printf("Error sending data packet\n");
+            error = 1;
+            break;
+        }
+        totalSent += packetSize - DATA_PACKET_HEADER_SIZE;
+        printProgress(totalSent, fileSize);
+    }
+
+    // acorda a thread de leitura se ainda estiver à espera de espaço na fila
+    ring_cancel(reader.ring);
+    pthread_join(readerId, NULL);
+    ring_destroy(reader.ring);
+    if (fileMap)
+        munmap((void *)fileMap, fileSize);
+    fclose(fp);
+    if (error)
+        return -1;
+    
+    // o END leva o digest do ficheiro
+    if (control->digestAlgorithm != DIGEST_NONE)
+        control->digestSize = digest_final(&reader.digest, control->digest);
+    if (sendEnd(control) < 0)
+        return -1;
+    printf("\nFile sent successfully.\n");
+    return 0;
+}
+
+// responde ao START start (guardado em path) se o emissor pediu: com a posição onde retomar (são os bytes
+// seguidos do checkpoint de uma transferência anterior do mesmo ficheiro, ou 0) e o que o recetor aceita (o lote
+// e as permissões de uma árvore voltam como vieram)
+// retorna a posição onde retomar, ou -1 se ocorrer algum erro
+long long replyToStart(const ControlPacket *start, const char *path) {
+    long long resumeOffset = 0;
+    if (start->resumeOffset < 0 && !start->batch)
+        return 0;
+
+    ControlPacket reply = *start;
+    if (start->resumeOffset >= 0) {
+        resumeOffset = RESUME_TRANSFERS ? readCheckpoint(path, start->fileSize, start->fileName) : 0;
+        reply.resumeOffset = resumeOffset;
+    }
+
+    unsigned char replyPacket[MAX_CONTROL_PACKET_SIZE];
+    int replySize = buildControlPacket(&reply, replyPacket);
+    if (replySize < 0 || llwrite(replyPacket, replySize) < 0) {
+        printf("Error sending START reply\n");
+        return -1;
+    }
+    if (resumeOffset > 0)
+        printf("Resuming at byte %lld\n", resumeOffset);
+    return resumeOffset;
+}
+
+// permissões a dar a uma entrada recebida com mode: só leitura, escrita e execução (nunca setuid, setgid ou
+// sticky), sem as que a umask do processo tira, como se o ficheiro tivesse sido criado aqui com esse modo
+int localMode(int mode) {
+    static int processUmask = -1; // lida uma só vez (umask() só se lê mudando-a)
+    if (processUmask < 0) {
+        processUmask = umask(0);
+        umask(processUmask);
+    }
+    return mode & 0777 & ~processUmask;
+}
+
+// recebe o ficheiro anunciado pelo START start (já lido) e guarda-o em path
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int receiveFile(const ControlPacket *start, const char *path, int maxPacketSize) {
+    printf("START packet received: file size = %lld, file name = %s\n", start->fileSize, start->fileName);
+
+    long long resumeOffset = replyToStart(start, path);
+    if (resumeOffset < 0)
+        return -1;
+    
+    // abrir o ficheiro para escrita (sem apagar o que já veio, se for para retomar)
+    // (também para leitura: numa retoma o digest tem de incluir o que já lá estava)
+    int fd = open(path, O_RDWR | O_CREAT | (resumeOffset > 0 ? 0 : O_TRUNC), 0666);
+    if (fd < 0) {
+        printf("Error creating file %s\n", path);
+        return -1;
+    }
+
+    // reserva logo o espaço anunciado no START (menos fragmentação); se não der escreve-se na mesma
+    if (start->fileSize > 0 && posix_fallocate(fd, 0, start->fileSize) != 0)
+        printf("Warning: could not preallocate %lld bytes\n", start->fileSize);
+
+    // numa retoma o emissor confirma a posição com um RESUME antes dos dados; se chega logo outro pacote, a
+    // resposta ao START não lhe chegou a tempo e ele começou do início (o pacote fica para a thread de escrita)
+    unsigned char firstPacket[maxPacketSize];
+    int firstSize = 0;
+    if (resumeOffset > 0) {
+        firstSize = llread(firstPacket);
+        if (firstSize < 0) {
+            printf("Error reading packet\n");
+            close(fd);
+            return -1;
+        }
+        ControlPacket resume;
+        if (firstSize > 0 && firstPacket[0] == RESUME && parseControlPacket(firstPacket, firstSize, &resume) == 0 &&
+            resume.resumeOffset == resumeOffset) {
+            firstSize = 0;
+        } else {
+            printf("Sender did not confirm the resume position, receiving from the start\n");
+            resumeOffset = 0;
+        }
+    }
+
+    // a thread de escrita trata do ficheiro; esta só lê e confirma as tramas
+    FileWriter writer;
+    writer.ring = ring_create(WRITE_QUEUE_PACKETS, maxPacketSize);
+    writer.fd = fd;
+    writer.filename = path;
+    writer.fileName = start->fileName;
+    writer.fileSize = start->fileSize;
+    writer.offset = resumeOffset;
+    writer.maxDataSize = maxPacketSize - DATA_PACKET_HEADER_SIZE;
+    writer.totalBytesReceived = resumeOffset;
+    writer.error = 0;
+    if (digest_init(&writer.digest, start->digestAlgorithm) < 0 && start->digestAlgorithm != DIGEST_NONE)
+        printf("Warning: unknown digest algorithm %d, file will not be verified\n", start->digestAlgorithm);
+    pthread_t writerId;
+    if (writer.ring == NULL || pthread_create(&writerId, NULL, writerThread, &writer) != 0) {
+        printf("Error starting file writer\n");
+        ring_destroy(writer.ring);
+        close(fd);
+        return -1;
+    }
+
+    // receber os dados (o llread escreve diretamente num slot da fila), até ao pacote END
+    int error = 0;
+    unsigned char *packet;
+    while ((packet = ring_reserve(writer.ring)) != NULL) {
+        int packetSize = firstSize;
+        if (firstSize > 0)
+            memcpy(packet, firstPacket, firstSize);
+        else
+            packetSize = llread(packet);
+        firstSize = 0;
+        if (packetSize < 0) {
+            printf("Error reading packet\n");
+            ring_publish(writer.ring, -1);
+            error = 1;
+            break;
+        }
+        int last = (packetSize > 0 && packet[0] == END);
+        ring_publish(writer.ring, packetSize);
+        if (last)
+            break;
+    }
+
+    pthread_join(writerId, NULL);
+    ring_destroy(writer.ring);
+    // numa árvore o ficheiro fica com as permissões do original (depois de escrito, podem não deixar escrever)
+    if (!error && !writer.error && start->mode >= 0 && fchmod(fd, localMode(start->mode)) < 0)
+        printf("Warning: could not set the permissions of %s\n", path);
+    close(fd);
+    if (error || writer.error)
+        return -1;
+    printf("\nFile received successfully, total bytes = %lld\n", writer.totalBytesReceived);
+    return 0;
+}
+
+// cria as pastas de path que ainda não existem a partir da posição from (as anteriores já existem)
+// retorna 0 em caso de sucesso, -1 se ocorrer algum erro
+int makeDirectories(char *path, int from) {
+    for (char *slash = strchr(path + from, '/'); ; slash = strchr(slash + 1, '/')) {
+        if (slash)
+            *slash = '\0';
+        int result = mkdir(path, 0777);
+        struct stat st;
+        if (result < 0 && (errno != EEXIST || stat(path, &st) < 0 || !S_ISDIR(st.st_mode))) {
+            printf("Error creating directory %s\n", path);
+            if (slash)
+                *slash = '/';
+            return -1;
+        }
+        if (!slash)
+            return 0;
+        *slash = '/';
+    }
+}
+
+// verifica se path é um caminho relativo que fica dentro da pasta de destino: vazio, ou nomes separados por
+// um só '/' e nenhum deles "." ou ".."
+int validTreePath(const char *path) {
+    if (path[0] == '\0')
+        return TRUE;
+    const char *part = path;
+    while (1) {
+        int len = strcspn(part, "/");
+        if (len == 0 || (len == 1 && part[0] == '.') || (len == 2 && part[0] == '.' && part[1] == '.'))
+            return FALSE;
+        if (part[len] == '\0')
+            return TRUE;
+        part += len + 1;
+    }
+}
 
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
                       int nTries, int timeout, const char *filename)
@@ -201,95 +1256,109 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         return;
     }
     printf("Connection established\n");
+
+    // tamanho máximo dos pacotes, acordado pela camada de ligação no llopen
+    int maxPacketSize = llmax_payload();
+    printf("Maximum packet size = %d bytes\n", maxPacketSize);
     
 
     // Transmitir ou receber o ficheiro
     if (connectionParameters.role == LlTx) {
         // Transmiter
-
-        // abrir o ficheiro
-        FILE *fp = fopen(filename, "rb");
-        if (!fp) {
-            printf("Error opening file %s\n", filename);
+        char **files;
+        int batch, rootLength;
+        int count = listFiles(filename, &files, &batch, &rootLength);
+        if (count < 0) {
             llclose(0);
             return;
         }
-        
-        // tamanho do ficheiro
-        fseek(fp, 0, SEEK_END);
-        long fileSize = ftell(fp);
 
-        fseek(fp, 0, SEEK_SET);
-        
-        printf("Sending file %s, size = %ld bytes\n", filename, fileSize);
-
-        // constroi e manda o control packet
-        unsigned char controlPacket[MAX_CONTROL_PACKET_SIZE];
-        int controlPacketSize = buildControlPacket(START, fileSize, filename, controlPacket);
-        int write_start = llwrite(controlPacket, controlPacketSize);
-        if (controlPacketSize < 0 || write_start < 0) {
-            printf("Error sending START packet\n");
-            fclose(fp);
-            llclose(0);
-            return;
-        }
-        
-        // lê o ficheiro e envia os dados
-        unsigned char fileBuffer[MAX_PACKET_DATA_SIZE];
-        unsigned char dataPacket[1 + 2 + MAX_PACKET_DATA_SIZE]; 
-        int bytesRead;
-        int written = 0;
-        long totalSent = 0; 
-
-        // tamanho da barra de progresso
-        const int barWidth = 50;
-        // lê o ficheiro e envia os dados
-        while ((bytesRead = fread(fileBuffer, 1, MAX_PACKET_DATA_SIZE, fp)) > 0) {
-            int dataPacketSize = buildDataPacket(fileBuffer, bytesRead, dataPacket);
-            written = llwrite(dataPacket, dataPacketSize);
-            if (written < 0) {
-                printf("Error sending data packet\n");
-                fclose(fp);
+        int sent = 0;
+        for (int i = 0; i < count; i++) {
+            ControlPacket control, reply;
+            int replied;
+            memset(&control, 0, sizeof(control));
+            control.batch = batch;
+            control.mode = -1;
+            int result;
+            if (rootLength > 0) {
+                // numa árvore vai a pasta relativa à raiz, o nome e as permissões; as pastas vão só com o START
+                struct stat st;
+                const char *name = baseName(files[i]);
+                int pathLen = name - files[i] - rootLength - 1;
+                if (pathLen > MAX_TREE_PATH) {
+                    printf("Error: path of %s too long, skipped\n", files[i]);
+                    continue;
+                }
+                if (lstat(files[i], &st) < 0) {
+                    printf("Error reading %s\n", files[i]);
+                    continue;
+                }
+                snprintf(control.path, sizeof(control.path), "%.*s", pathLen > 0 ? pathLen : 0, files[i] + rootLength);
+                snprintf(control.fileName, sizeof(control.fileName), "%s", name);
+                control.mode = st.st_mode & 0777;
+                control.directory = S_ISDIR(st.st_mode);
+                if (control.directory) {
+                    control.type = START;
+                    control.resumeOffset = -1;
+                    printf("Sending directory %s\n", files[i]);
+                    result = sendStart(&control, &reply, &replied, maxPacketSize, timeout);
+                } else {
+                    result = sendFile(files[i], &control, &reply, &replied, maxPacketSize, timeout);
+                }
+            } else {
+                // num lote vai só o nome do ficheiro, sem a pasta
+                snprintf(control.fileName, sizeof(control.fileName), "%s", batch ? baseName(files[i]) : files[i]);
+                result = sendFile(files[i], &control, &reply, &replied, maxPacketSize, timeout);
+            }
+            if (result < 0) {
+                freeFiles(files, count);
                 llclose(0);
                 return;
             }
-            totalSent += bytesRead;
-
-            // calcula percentagem
-            int percent = (int)((totalSent * 100) / fileSize);
-            
-            // imprimi barra de progresso
-            printf("\r["); 
-            int pos = (percent * barWidth) / 100;
-            for (int i = 0; i < barWidth; i++) {
-                if (i < pos)
-                    printf("*");
-                else
-                    printf(" ");
+            if (result > 0)
+                continue; // não abriu, passa ao seguinte
+            sent++;
+
+            // um recetor sem lotes (não responde ao START) ou sem árvores (responde sem as permissões) tomou a
+            // entrada por um ficheiro: uma pasta ficou por fechar e ele espera pelo END, que vai antes de sair
+            int noBatch = batch && (!replied || !reply.batch);
+            int noTree = rootLength > 0 && (!replied || reply.mode < 0);
+            if (noBatch || noTree) {
+                if (control.directory && sendEnd(&control) < 0) {
+                    freeFiles(files, count);
+                    llclose(0);
+                    return;
+                }
+                if (noBatch) {
+                    printf("Error: receiver does not support batches, only %s was sent\n", files[i]);
+                    batch = FALSE;
+                } else {
+                    printf("Error: receiver does not support directory trees, only %s was sent\n", files[i]);
+                }
+                break;
             }
-            printf("] %d%%", percent);
-            fflush(stdout);
         }
-        fclose(fp);
-        
-        // constroi e manda o pacote de controlo END
-        controlPacketSize = buildControlPacket(END, fileSize, filename, controlPacket);
-        int write_end = llwrite(controlPacket, controlPacketSize);
-        if (controlPacketSize < 0 || write_end < 0) {
-            printf("\nError sending END packet\n");
-            llclose(0);
-            return;
+        freeFiles(files, count);
+
+        // fim do lote
+        if (batch) {
+            unsigned char sessionEnd = SESSION_END;
+            if (llwrite(&sessionEnd, 1) < 0) {
+                printf("Error sending SESSION_END packet\n");
+                llclose(0);
+                return;
+            }
+            printf("Batch sent: %d of %d entries\n", sent, count);
         }
-        printf("\nFile sent successfully.\n");
-    
     }
     else if (connectionParameters.role == LlRx) {
         // Receiver
-        unsigned char packetBuffer[1 + 2 + MAX_PACKET_DATA_SIZE] = {0};
-        int packetSize;
+        unsigned char packetBuffer[maxPacketSize];
+        memset(packetBuffer, 0, maxPacketSize);
         
         // espera pelo pacote de controlo START
-        packetSize = llread(packetBuffer);
+        int packetSize = llread(packetBuffer);
 
         if (packetSize < 0) {
             printf("Error reading START packet\n");
@@ -297,86 +1366,93 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
             return;
         }
         // verifica se é o pacote START
-        int ctrlType = 0;
-        long fileSize = 0;
-        char receivedFileName[MAX_FILENAME] = {0};
-        int parse_result = parseControlPacket(packetBuffer, packetSize, &ctrlType, &fileSize, receivedFileName);
-        if (parse_result < 0 || ctrlType != START) {
+        ControlPacket start;
+        if (parseControlPacket(packetBuffer, packetSize, &start) < 0 || start.type != START) {
             printf("Error: Expected START packet\n");
             llclose(0);
             return;
         }
-        printf("START packet received: file size = %ld, file name = %s\n", fileSize, receivedFileName);
-        
-        // abrir o ficheiro para escrita 
-        FILE *fp = fopen(filename, "wb");
-        if (!fp) {
-            printf("Error creating file %s\n", filename);
-            llclose(0);
-            return;
-        }
-        
-        long totalBytesReceived = 0;
 
-        const int barWidth = 50;
-        // receber os dados
-        int finish = 1;
-        while (finish) {
-            packetSize = llread(packetBuffer);
-            if (packetSize < 0) {
-                printf("Error reading packet\n");
-                fclose(fp);
+        if (!start.batch) {
+            // as permissões só vêm com as árvores: um ficheiro solto fica com as do nome que se deu
+            start.mode = -1;
+            if (receiveFile(&start, filename, maxPacketSize) < 0) {
                 llclose(0);
                 return;
             }
-            
-            int packetType = packetBuffer[0];
-            // verifica se é um pacote de dados
-            if (packetType == DATA) {
-                int payloadSize;
-                unsigned char fileBuffer[MAX_PACKET_DATA_SIZE];
-                if (parseDataPacket(packetBuffer, packetSize, &payloadSize, fileBuffer) < 0) {
-                    printf("Error parsing data packet\n");
-                    fclose(fp);
-                    llclose(0);
-                    return;
+        } else {
+            // lote: os ficheiros vão para a pasta filename, até ao SESSION_END
+            if (mkdir(filename, 0777) < 0 && errno != EEXIST) {
+                printf("Error creating directory %s\n", filename);
+                llclose(0);
+                return;
+            }
+
+            // permissões das pastas de uma árvore, aplicadas no fim (podem não deixar criar o que vem dentro)
+            ReceivedDirectory *directories = NULL;
+            int directoryCount = 0;
+
+            int received = 0;
+            int error = 0;
+            while (1) {
+                // só o nome e uma pasta relativa, nunca um caminho para fora da pasta
+                const char *name = baseName(start.fileName);
+                if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || !validTreePath(start.path)) {
+                    printf("Error: invalid file name %s/%s\n", start.path, start.fileName);
+                    error = 1;
+                    break;
                 }
-                fwrite(fileBuffer, 1, payloadSize, fp);
-                totalBytesReceived += payloadSize;
-                
-                // imprime a barra de progresso
-                int percent = (int)((totalBytesReceived * 100) / fileSize);
-                printf("\r["); 
-                int pos = (percent * barWidth) / 100;
-                for (int i = 0; i < barWidth; i++) {
-                    if (i < pos)
-                        printf("*");
-                    else
-                        printf(" ");
+                char path[PATH_MAX_LENGTH];
+                int rootLength = snprintf(path, sizeof(path), "%s/", filename);
+                snprintf(path + rootLength, sizeof(path) - rootLength, "%s%s%s", start.path, start.path[0] ? "/" : "", name);
+
+                if (start.directory) {
+                    printf("START packet received: directory %s\n", path);
+                    error = (makeDirectories(path, rootLength) < 0 || replyToStart(&start, path) < 0);
+                    if (!error && appendDirectory(&directories, &directoryCount, path, start.mode) < 0)
+                        printf("Warning: could not keep the permissions of %s\n", path);
+                } else {
+                    // a pasta do ficheiro já devia ter vindo antes, mas cria-a se faltar
+                    char *slash = strrchr(path, '/');
+                    *slash = '\0';
+                    error = (slash > path + rootLength && makeDirectories(path, rootLength) < 0);
+                    *slash = '/';
+                    error = error || receiveFile(&start, path, maxPacketSize) < 0;
                 }
-                printf("] %d%%", percent);
-                fflush(stdout);
-            }
-            else if (packetType == END) {
-                // verifica se é o pacote END
-                if (parseControlPacket(packetBuffer, packetSize, &ctrlType, &fileSize, receivedFileName) < 0 || ctrlType != END) {
-                    printf("Error parsing END packet\n");
-                    fclose(fp);
-                    llclose(0);
-                    return;
+                if (error)
+                    break;
+                received++;
+
+                packetSize = llread(packetBuffer);
+                if (packetSize < 0) {
+                    printf("Error reading packet\n");
+                    error = 1;
+                    break;
                 }
-                finish = 0;
-                printf("\nEND packet received\n");
+                if (packetSize == 1 && packetBuffer[0] == SESSION_END)
+                    break;
+                if (parseControlPacket(packetBuffer, packetSize, &start) < 0 || start.type != START) {
+                    printf("Error: Expected START packet\n");
+                    error = 1;
+                    break;
+                }
+            }
+
+            // as subpastas primeiro (foram recebidas depois da pasta onde estão)
+            for (int i = directoryCount - 1; i >= 0; i--) {
+                if (directories[i].mode >= 0 && chmod(directories[i].path, localMode(directories[i].mode)) < 0)
+                    printf("Warning: could not set the permissions of %s\n", directories[i].path);
+                free(directories[i].path);
+            }
+            free(directories);
+            if (error) {
+                llclose(0);
+                return;
             }
-            
+            printf("Batch received: %d entries\n", received);
         }
-        fclose(fp);
-        printf("\nFile received successfully, total bytes = %ld\n", totalBytesReceived);
-        
     }
     
-    // fecha a conexão
-    llclose(FALSE);
+    // Fecha conexão e dá print às estatisticas
+    llclose(TRUE);
 }
-
-
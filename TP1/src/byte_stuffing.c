@@ -0,0 +1,291 @@
+// Byte stuffing kernels: versão escalar (referência) e versões SSE2/AVX2 escolhidas em runtime
+
+#include "byte_stuffing.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#ifdef STUFFING_X86
+#include <immintrin.h>
+#endif
+
+#define FLAG 0x7E
+#define ESCAPE 0x7D
+
+////////////////////////////////////////////////
+// ESCALAR
+////////////////////////////////////////////////
+int stuff_bytes_scalar(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2) {
+    int j = 0;
+    unsigned char xor = 0;
+    for (int i = 0; i < size; i++) {
+        xor ^= src[i];
+        if (src[i] == FLAG || src[i] == ESCAPE) {
+            dst[j++] = ESCAPE;
+            dst[j++] = src[i] ^ 0x20;
+        } else {
+            dst[j++] = src[i];
+        }
+    }
+    *bcc2 ^= xor;
+    return j;
+}
+
+int destuff_bytes_scalar(unsigned char *dst, const unsigned char *src, int size) {
+    int j = 0;
+    for (int i = 0; i < size; i++) {
+        if (src[i] == ESCAPE) {
+            i++;
+            if (i < size) dst[j++] = src[i] ^ 0x20;
+        } else {
+            dst[j++] = src[i];
+        }
+    }
+    return j;
+}
+
+#ifdef STUFFING_X86
+////////////////////////////////////////////////
+// SSE2 (blocos de 16 bytes)
+////////////////////////////////////////////////
+// XOR de todos os bytes de um registo de 16 bytes (BCC2)
+__attribute__((target("sse2")))
+static inline unsigned char xor_reduce16(__m128i acc) {
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 4));
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 2));
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 1));
+    return (unsigned char)_mm_cvtsi128_si32(acc);
+}
+
+// Faz stuffing de um bloco de 16 bytes, dada a máscara dos bytes especiais (FLAG/ESCAPE).
+// Retorna o número de bytes escritos (16 a 32)
+__attribute__((target("sse2")))
+static inline int stuff_block16(unsigned char *dst, const unsigned char *src, unsigned int mask) {
+    __m128i block = _mm_loadu_si128((const __m128i *)src);
+
+    // Bloco limpo: cópia direta
+    if (mask == 0) {
+        _mm_storeu_si128((__m128i *)dst, block);
+        return 16;
+    }
+
+    // Só bytes especiais (pior caso): intercala ESCAPE com byte ^ 0x20
+    if (mask == 0xFFFF) {
+        const __m128i escape = _mm_set1_epi8(ESCAPE);
+        __m128i escaped = _mm_xor_si128(block, _mm_set1_epi8(0x20));
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(escape, escaped));
+        _mm_storeu_si128((__m128i *)&dst[16], _mm_unpackhi_epi8(escape, escaped));
+        return 32;
+    }
+
+    // Misto: sem saltos, o bit da máscara decide se o byte leva ESCAPE
+    int j = 0;
+    for (int k = 0; k < 16; k++) {
+        int special = (mask >> k) & 1;
+        dst[j] = ESCAPE;
+        dst[j + special] = src[k] ^ (special << 5);
+        j += 1 + special;
+    }
+    return j;
+}
+
+// As escritas em blocos cabem sempre no destino: j <= 2 * i e i + 16 <= size.
+// O BCC2 é acumulado num registo ao mesmo tempo (XOR bloco a bloco)
+__attribute__((target("sse2")))
+int stuff_bytes_sse2(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2) {
+    const __m128i flag = _mm_set1_epi8(FLAG);
+    const __m128i escape = _mm_set1_epi8(ESCAPE);
+    __m128i acc = _mm_setzero_si128();
+    int i = 0, j = 0;
+
+    while (i + 16 <= size) {
+        __m128i block = _mm_loadu_si128((const __m128i *)&src[i]);
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, flag),
+                                                           _mm_cmpeq_epi8(block, escape)));
+        acc = _mm_xor_si128(acc, block);
+        j += stuff_block16(&dst[j], &src[i], mask);
+        i += 16;
+    }
+
+    *bcc2 ^= xor_reduce16(acc);
+    return j + stuff_bytes_scalar(&dst[j], &src[i], size - i, bcc2);
+}
+
+// Só o ESCAPE interessa. O bloco é copiado antes de ver a máscara (j <= i, cabe no destino):
+// sem ESCAPEs fica feito, senão a parte a seguir ao primeiro ESCAPE é tratada byte a byte.
+// Pares (ESCAPE, byte) em todo o bloco (pior caso) são compactados de uma vez
+__attribute__((target("sse2")))
+int destuff_bytes_sse2(unsigned char *dst, const unsigned char *src, int size) {
+    const __m128i escape = _mm_set1_epi8(ESCAPE);
+    int i = 0, j = 0;
+
+    while (i + 16 <= size) {
+        __m128i block = _mm_loadu_si128((const __m128i *)&src[i]);
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, escape));
+        _mm_storeu_si128((__m128i *)&dst[j], block);
+        if (mask == 0) {
+            i += 16;
+            j += 16;
+            continue;
+        }
+
+        if (mask == 0x5555) {
+            __m128i bytes = _mm_packus_epi16(_mm_srli_epi16(block, 8), _mm_setzero_si128());
+            _mm_storel_epi64((__m128i *)&dst[j], _mm_xor_si128(bytes, _mm_set1_epi8(0x20)));
+            i += 16;
+            j += 8;
+            continue;
+        }
+
+        int k = __builtin_ctz(mask);
+        j += k;
+        while (k < 16 && i + k < size) {
+            if (src[i + k] == ESCAPE) {
+                if (i + k + 1 < size) dst[j++] = src[i + k + 1] ^ 0x20;
+                k += 2;
+            } else {
+                dst[j++] = src[i + k];
+                k++;
+            }
+        }
+        i += k;
+    }
+
+    if (i >= size) return j;
+    return j + destuff_bytes_scalar(&dst[j], &src[i], size - i);
+}
+
+////////////////////////////////////////////////
+// AVX2 (blocos de 32 bytes)
+////////////////////////////////////////////////
+__attribute__((target("avx2")))
+int stuff_bytes_avx2(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2) {
+    const __m256i flag = _mm256_set1_epi8(FLAG);
+    const __m256i escape = _mm256_set1_epi8(ESCAPE);
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0, j = 0;
+
+    while (i + 32 <= size) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)&src[i]);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, flag),
+                                                                  _mm256_cmpeq_epi8(block, escape)));
+        acc = _mm256_xor_si256(acc, block);
+        if (mask == 0) {
+            _mm256_storeu_si256((__m256i *)&dst[j], block);
+            j += 32;
+        } else if (mask == 0xFFFFFFFF) {
+            // unpack trabalha em cada metade de 128 bits, o permute repõe a ordem
+            __m256i escaped = _mm256_xor_si256(block, _mm256_set1_epi8(0x20));
+            __m256i lo = _mm256_unpacklo_epi8(escape, escaped);
+            __m256i hi = _mm256_unpackhi_epi8(escape, escaped);
+            _mm256_storeu_si256((__m256i *)&dst[j], _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i *)&dst[j + 32], _mm256_permute2x128_si256(lo, hi, 0x31));
+            j += 64;
+        } else {
+            // Bloco misto: cada metade limpa ainda é copiada inteira
+            j += stuff_block16(&dst[j], &src[i], mask & 0xFFFF);
+            j += stuff_block16(&dst[j], &src[i + 16], mask >> 16);
+        }
+        i += 32;
+    }
+
+    *bcc2 ^= xor_reduce16(_mm_xor_si128(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+    return j + stuff_bytes_sse2(&dst[j], &src[i], size - i, bcc2);
+}
+
+__attribute__((target("avx2")))
+int destuff_bytes_avx2(unsigned char *dst, const unsigned char *src, int size) {
+    const __m256i escape = _mm256_set1_epi8(ESCAPE);
+    int i = 0, j = 0;
+
+    while (i + 32 <= size) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)&src[i]);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, escape));
+        _mm256_storeu_si256((__m256i *)&dst[j], block);
+        if (mask == 0) {
+            i += 32;
+            j += 32;
+            continue;
+        }
+
+        if (mask == 0x55555555) {
+            __m256i bytes = _mm256_packus_epi16(_mm256_srli_epi16(block, 8), _mm256_setzero_si256());
+            bytes = _mm256_permute4x64_epi64(bytes, 0x08);
+            _mm_storeu_si128((__m128i *)&dst[j], _mm_xor_si128(_mm256_castsi256_si128(bytes), _mm_set1_epi8(0x20)));
+            i += 32;
+            j += 16;
+            continue;
+        }
+
+        int k = __builtin_ctz(mask);
+        j += k;
+        while (k < 32 && i + k < size) {
+            if (src[i + k] == ESCAPE) {
+                if (i + k + 1 < size) dst[j++] = src[i + k + 1] ^ 0x20;
+                k += 2;
+            } else {
+                dst[j++] = src[i + k];
+                k++;
+            }
+        }
+        i += k;
+    }
+
+    if (i >= size) return j;
+    return j + destuff_bytes_sse2(&dst[j], &src[i], size - i);
+}
+
+int cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+int cpu_has_sse2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+#endif
+
+////////////////////////////////////////////////
+// ESCOLHA EM RUNTIME
+////////////////////////////////////////////////
+int (*stuff_kernel)(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2) = NULL;
+int (*destuff_kernel)(unsigned char *dst, const unsigned char *src, int size) = NULL;
+const char *kernel_name = "scalar";
+pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// Escolhe a melhor implementação suportada pelo processador (uma só vez, com pthread_once: várias sessões
+// e as threads da aplicação usam o stuffing ao mesmo tempo)
+void select_kernels() {
+    stuff_kernel = stuff_bytes_scalar;
+    destuff_kernel = destuff_bytes_scalar;
+    kernel_name = "scalar";
+
+#ifdef STUFFING_X86
+    if (cpu_has_avx2()) {
+        stuff_kernel = stuff_bytes_avx2;
+        destuff_kernel = destuff_bytes_avx2;
+        kernel_name = "avx2";
+    } else if (cpu_has_sse2()) {
+        stuff_kernel = stuff_bytes_sse2;
+        destuff_kernel = destuff_bytes_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+int stuff_bytes(unsigned char *dst, const unsigned char *src, int size, unsigned char *bcc2) {
+    pthread_once(&kernels_once, select_kernels);
+    return stuff_kernel(dst, src, size, bcc2);
+}
+
+int destuff_bytes(unsigned char *dst, const unsigned char *src, int size) {
+    pthread_once(&kernels_once, select_kernels);
+    return destuff_kernel(dst, src, size);
+}
+
+const char *stuffing_kernel_name() {
+    pthread_once(&kernels_once, select_kernels);
+    return kernel_name;
+}
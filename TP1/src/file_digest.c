@@ -0,0 +1,252 @@
+// Digests incrementais dos ficheiros transferidos (xxHash64 e SHA-256)
+
+#include "file_digest.h"
+
+#include <string.h>
+
+////////////////////////////////////////////////
+// XXH64
+////////////////////////////////////////////////
+// Blocos de 32 bytes em quatro acumuladores, com os primos e rotações da especificação do xxHash
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// leituras little-endian, como na especificação (independentes da máquina)
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh64_round(0, value);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// processa blocks blocos de 32 bytes
+static void xxh64_blocks(uint64_t *v, const unsigned char *p, size_t blocks) {
+    uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+    for (size_t i = 0; i < blocks; i++, p += 32) {
+        v1 = xxh64_round(v1, read64(p));
+        v2 = xxh64_round(v2, read64(p + 8));
+        v3 = xxh64_round(v3, read64(p + 16));
+        v4 = xxh64_round(v4, read64(p + 24));
+    }
+    v[0] = v1; v[1] = v2; v[2] = v3; v[3] = v4;
+}
+
+static uint64_t xxh64_final(FileDigest *digest) {
+    const uint64_t *v = digest->state.xxh64;
+    uint64_t h;
+    if (digest->length >= 32) {
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for (int i = 0; i < 4; i++) h = xxh64_merge(h, v[i]);
+    } else {
+        h = XXH_PRIME5; // semente 0: v[2] ainda é a semente
+    }
+    h += digest->length;
+
+    // o que sobrou (menos de 32 bytes)
+    const unsigned char *p = digest->buffer;
+    int left = digest->buffered;
+    for (; left >= 8; left -= 8, p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (left >= 4) {
+        h ^= (uint64_t)read32(p) * XXH_PRIME1;
+        h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        left -= 4;
+        p += 4;
+    }
+    for (; left > 0; left--, p++) {
+        h ^= (*p) * XXH_PRIME5;
+        h = rotl64(h, 11) * XXH_PRIME1;
+    }
+
+    // avalanche
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+////////////////////////////////////////////////
+// SHA-256
+////////////////////////////////////////////////
+// FIPS 180-4: blocos de 64 bytes, 64 rondas
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr32(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+// processa blocks blocos de 64 bytes
+static void sha256_blocks(uint32_t *state, const unsigned char *p, size_t blocks) {
+    for (size_t b = 0; b < blocks; b++, p += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) |
+                   ((uint32_t)p[4 * i + 2] << 8) | (uint32_t)p[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b2 = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+            uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b2) ^ (a & c) ^ (b2 & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b2; b2 = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b2; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+static void sha256_final(FileDigest *digest, unsigned char *out) {
+    // padding: 0x80, zeros e o comprimento em bits (big-endian) no fim do último bloco
+    uint64_t bits = digest->length * 8;
+    unsigned char *buffer = digest->buffer;
+    int n = digest->buffered;
+    buffer[n++] = 0x80;
+    if (n > 56) {
+        memset(&buffer[n], 0, 64 - n);
+        sha256_blocks(digest->state.sha256, buffer, 1);
+        n = 0;
+    }
+    memset(&buffer[n], 0, 56 - n);
+    for (int i = 0; i < 8; i++) buffer[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha256_blocks(digest->state.sha256, buffer, 1);
+
+    for (int i = 0; i < 8; i++) {
+        uint32_t v = digest->state.sha256[i];
+        out[4 * i] = v >> 24;
+        out[4 * i + 1] = v >> 16;
+        out[4 * i + 2] = v >> 8;
+        out[4 * i + 3] = v;
+    }
+}
+
+////////////////////////////////////////////////
+// DIGEST
+////////////////////////////////////////////////
+int digest_size(int algorithm) {
+    switch (algorithm) {
+        case DIGEST_XXH64: return 8;
+        case DIGEST_SHA256: return 32;
+        default: return 0;
+    }
+}
+
+const char *digest_name(int algorithm) {
+    switch (algorithm) {
+        case DIGEST_XXH64: return "xxh64";
+        case DIGEST_SHA256: return "sha256";
+        default: return "none";
+    }
+}
+
+// tamanho dos blocos do algoritmo
+static int block_size(int algorithm) {
+    return algorithm == DIGEST_SHA256 ? 64 : 32;
+}
+
+static void process_blocks(FileDigest *digest, const unsigned char *data, size_t blocks) {
+    if (digest->algorithm == DIGEST_SHA256) sha256_blocks(digest->state.sha256, data, blocks);
+    else xxh64_blocks(digest->state.xxh64, data, blocks);
+}
+
+int digest_init(FileDigest *digest, int algorithm) {
+    memset(digest, 0, sizeof(*digest));
+    digest->algorithm = algorithm;
+    if (algorithm == DIGEST_XXH64) {
+        // semente 0
+        digest->state.xxh64[0] = XXH_PRIME1 + XXH_PRIME2;
+        digest->state.xxh64[1] = XXH_PRIME2;
+        digest->state.xxh64[2] = 0;
+        digest->state.xxh64[3] = 0 - XXH_PRIME1;
+        return 0;
+    }
+    if (algorithm == DIGEST_SHA256) {
+        static const uint32_t initial[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+        memcpy(digest->state.sha256, initial, sizeof(initial));
+        return 0;
+    }
+    digest->algorithm = DIGEST_NONE;
+    return -1;
+}
+
+void digest_update(FileDigest *digest, const unsigned char *data, size_t size) {
+    if (digest_size(digest->algorithm) == 0) return;
+    int block = block_size(digest->algorithm);
+    digest->length += size;
+
+    // completa o bloco começado na chamada anterior
+    if (digest->buffered > 0) {
+        size_t take = (size < (size_t)(block - digest->buffered)) ? size : (size_t)(block - digest->buffered);
+        memcpy(&digest->buffer[digest->buffered], data, take);
+        digest->buffered += take;
+        data += take;
+        size -= take;
+        if (digest->buffered < block) return;
+        process_blocks(digest, digest->buffer, 1);
+        digest->buffered = 0;
+    }
+
+    // os blocos inteiros são processados diretamente dos dados, sem cópia
+    size_t blocks = size / block;
+    process_blocks(digest, data, blocks);
+    data += blocks * block;
+    size -= blocks * block;
+
+    memcpy(digest->buffer, data, size);
+    digest->buffered = size;
+}
+
+int digest_final(FileDigest *digest, unsigned char *out) {
+    if (digest->algorithm == DIGEST_XXH64) {
+        uint64_t h = xxh64_final(digest);
+        for (int i = 0; i < 8; i++) out[i] = (unsigned char)(h >> (56 - 8 * i));
+        return 8;
+    }
+    if (digest->algorithm == DIGEST_SHA256) {
+        sha256_final(digest, out);
+        return 32;
+    }
+    return 0;
+}
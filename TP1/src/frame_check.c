@@ -0,0 +1,216 @@
+// Campo de verificação das tramas: BCC2, CRC-16-CCITT e CRC-32C (SSE4.2 ou slicing-by-8 escolhido em runtime)
+
+#include "frame_check.h"
+#include "byte_stuffing.h"
+
+#include <pthread.h>
+
+#ifdef CHECK_X86
+#include <immintrin.h>
+#endif
+
+#define ESCAPE 0x7D
+
+// Os CRC são refletidos (bit menos significativo primeiro, como a UART os envia), começam com o registo a 1s e
+// invertem-no no fim; o campo sai com o byte menos significativo primeiro. Assim o registo depois dos dados e
+// do campo recebido fica sempre com o mesmo resíduo
+#define CRC16_POLY 0x8408     // x^16 + x^12 + x^5 + 1, refletido
+#define CRC16_RESIDUE 0xF0B8
+#define CRC32C_POLY 0x82F63B78 // Castagnoli, refletido
+#define CRC32C_RESIDUE 0xB798B438
+
+// Os dados passam pelo CRC e pelo stuffing em blocos deste tamanho: o segundo a ler cada bloco já o encontra na cache
+#define CHECK_CHUNK 1024
+
+////////////////////////////////////////////////
+// TABELAS
+////////////////////////////////////////////////
+uint16_t crc16_table[256];
+uint32_t crc32c_table[8][256];
+uint32_t (*crc32c_kernel)(uint32_t crc, const unsigned char *data, int size) = NULL;
+const char *crc32c_name = "slicing-by-8";
+pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// Gera as tabelas e escolhe a implementação do CRC-32C (uma só vez, com pthread_once: o emissor e o recetor
+// de sessões diferentes podem começar ao mesmo tempo)
+void init_tables() {
+    for (int n = 0; n < 256; n++) {
+        uint32_t crc16 = n, crc32 = n;
+        for (int k = 0; k < 8; k++) {
+            crc16 = (crc16 & 1) ? (crc16 >> 1) ^ CRC16_POLY : crc16 >> 1;
+            crc32 = (crc32 & 1) ? (crc32 >> 1) ^ CRC32C_POLY : crc32 >> 1;
+        }
+        crc16_table[n] = crc16;
+        crc32c_table[0][n] = crc32;
+    }
+    // tabela k: o efeito de um byte seguido de k bytes a zero
+    for (int n = 0; n < 256; n++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc32c_table[k - 1][n];
+            crc32c_table[k][n] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+
+    crc32c_kernel = crc32c_slicing8;
+    crc32c_name = "slicing-by-8";
+#ifdef CHECK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_kernel = crc32c_sse42;
+        crc32c_name = "sse4.2";
+    }
+#endif
+}
+
+////////////////////////////////////////////////
+// CRC
+////////////////////////////////////////////////
+uint32_t crc16_update(uint32_t crc, const unsigned char *data, int size) {
+    for (int i = 0; i < size; i++) {
+        crc = (crc >> 8) ^ crc16_table[(crc ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+// 8 bytes por iteração, com uma tabela por posição do byte
+uint32_t crc32c_slicing8(uint32_t crc, const unsigned char *data, int size) {
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const unsigned char *p = &data[i];
+        uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+    }
+    for (; i < size; i++) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef CHECK_X86
+// Instrução crc32 do SSE4.2 (usa o polinómio de Castagnoli)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, int size) {
+    int i = 0;
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        __builtin_memcpy(&word, &data[i], 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; i + 4 <= size; i += 4) {
+        uint32_t word;
+        __builtin_memcpy(&word, &data[i], 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; i < size; i++) {
+        crc = _mm_crc32_u8(crc, data[i]);
+    }
+    return crc;
+}
+#endif
+
+////////////////////////////////////////////////
+// CAMPO DE VERIFICAÇÃO
+////////////////////////////////////////////////
+int check_size(int check) {
+    switch (check) {
+        case CHECK_BCC: return 1;
+        case CHECK_CRC16: return 2;
+        case CHECK_CRC32C: return 4;
+        default: return 0;
+    }
+}
+
+const char *check_name(int check) {
+    switch (check) {
+        case CHECK_CRC16: return "crc16";
+        case CHECK_CRC32C: return "crc32c";
+        default: return "bcc";
+    }
+}
+
+const char *crc32c_kernel_name() {
+    pthread_once(&tables_once, init_tables);
+    return crc32c_name;
+}
+
+uint32_t check_init(int check) {
+    pthread_once(&tables_once, init_tables);
+    switch (check) {
+        case CHECK_CRC16: return 0xFFFF;
+        case CHECK_CRC32C: return 0xFFFFFFFF;
+        default: return 0;
+    }
+}
+
+uint32_t check_update(int check, uint32_t crc, const unsigned char *data, int size) {
+    switch (check) {
+        case CHECK_CRC16: return crc16_update(crc, data, size);
+        case CHECK_CRC32C: return crc32c_kernel(crc, data, size);
+        default: {
+            unsigned char bcc2 = crc;
+            for (int i = 0; i < size; i++) bcc2 ^= data[i];
+            return bcc2;
+        }
+    }
+}
+
+int check_final(int check, uint32_t crc, unsigned char *out) {
+    int size = check_size(check);
+    if (check != CHECK_BCC) crc = ~crc;
+    for (int i = 0; i < size; i++) {
+        out[i] = (crc >> (8 * i)) & 0xFF;
+    }
+    return size;
+}
+
+int check_valid(int check, uint32_t crc) {
+    switch (check) {
+        case CHECK_CRC16: return crc == CRC16_RESIDUE;
+        case CHECK_CRC32C: return crc == CRC32C_RESIDUE;
+        default: return crc == 0;
+    }
+}
+
+////////////////////////////////////////////////
+// STUFFING COM VERIFICAÇÃO
+////////////////////////////////////////////////
+int stuff_bytes_check(unsigned char *dst, const unsigned char *src, int size, int check, uint32_t *crc) {
+    // o BCC2 já é calculado pelos kernels de stuffing
+    if (check == CHECK_BCC) {
+        unsigned char bcc2 = *crc;
+        int j = stuff_bytes(dst, src, size, &bcc2);
+        *crc = bcc2;
+        return j;
+    }
+
+    int j = 0;
+    for (int i = 0; i < size; i += CHECK_CHUNK) {
+        int chunk = (size - i < CHECK_CHUNK) ? size - i : CHECK_CHUNK;
+        unsigned char unused = 0;
+        *crc = check_update(check, *crc, &src[i], chunk);
+        j += stuff_bytes(&dst[j], &src[i], chunk, &unused);
+    }
+    return j;
+}
+
+int destuff_bytes_check(unsigned char *dst, const unsigned char *src, int size, int check, uint32_t *crc) {
+    int j = 0;
+    for (int i = 0; i < size; ) {
+        int chunk = (size - i < CHECK_CHUNK) ? size - i : CHECK_CHUNK;
+        // um ESCAPE no fim do bloco vai com o byte a seguir
+        if (i + chunk < size && src[i + chunk - 1] == ESCAPE) chunk++;
+        int written = destuff_bytes(&dst[j], &src[i], chunk);
+        *crc = check_update(check, *crc, &dst[j], written);
+        j += written;
+        i += chunk;
+    }
+    return j;
+}
@@ -1,8 +1,14 @@
 // Link layer protocol implementation
 
 #include "link_layer.h"
+#include "link_session.h"
+#include "byte_stuffing.h"
+#include "frame_check.h"
+#include "reed_solomon.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,10 +17,11 @@
 #include <termios.h>
 #include <unistd.h>
 
-#include <signal.h>
-
-LinkLayer global_connectionParameters;
-int global_fd;
+#include <poll.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <time.h>
 
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
@@ -22,12 +29,19 @@ int global_fd;
 #define FALSE 0
 #define TRUE 1
 
-#define sleep_time 1
-
-// tamanho do buffer
-#define BUF_SIZE 512
-// tamanho do buffer com stuffing (pior caso)
-#define MAX_BUF_SIZE BUF_SIZE*2
+// Campo de informação das tramas I (dados da camada de aplicação), negociado no SET/UA:
+// cada lado propõe o seu máximo e fica o menor. Sem o parâmetro usa-se o tamanho antigo, o maior pacote que a
+// aplicação antiga aceita (1 + 2 + 502 bytes de dados): passar disto estoirava os buffers de um recetor antigo.
+// Tramas jumbo (até 65535 bytes, o máximo do parâmetro) reduzem cabeçalhos, respostas e esperas em linhas rápidas
+#define MAX_INFO_SIZE 32768
+#define MIN_INFO_SIZE 64
+#define DEFAULT_INFO_SIZE 505
+// O máximo proposto também fica limitado ao que a UART envia neste tempo ao baudRate configurado
+// (a 9600 bit/s uma trama de 32 KiB levava 34 s, e um erro obrigava a repeti-la toda)
+#define MAX_FRAME_TIME_MS 1000
+// tamanho de uma trama com stuffing (pior caso) para um campo de informação de n bytes: FLAG, A, C, BCC1,
+// dados e campo de verificação com stuffing, FLAG
+#define STUFFED_FRAME_SIZE(n) (2 * (n) + 2 + 6 + 2 * CHECK_MAX_SIZE)
 
 // Frame constantes
 #define FLAG 0x7E
@@ -74,44 +88,249 @@ int global_fd;
 #define C_REJ_1 0x81
 #define BCC1_REJ_1 A^C_REJ_1
 
-volatile int ESTABLISHMENT = FALSE;
-volatile int WRITE = FALSE;
+//SREJ constantes (só em Selective Repeat, número de sequência nos bits 5 a 7)
+#define C_SREJ_0 0x0D
+
+// Janela deslizante (Go-Back-N ou Selective Repeat)
+// tamanho máximo da janela proposto no SET (1 = stop-and-wait)
+#define WINDOW_SIZE 7
+// módulo dos números de sequência com janela > 1 (3 bits)
+#define SEQ_MOD_WINDOW 8
+
+// Timeout de retransmissão em milissegundos. Se for 0 usa o timeout (em segundos) dado pela aplicação
+#define TIMEOUT_MS 0
+
+// Timeout de retransmissão adaptativo (RFC 6298): RTO = SRTT + 4 * RTTVAR, medido nas confirmações.
+// O timeout acima é só o valor inicial (e o das tramas de controlo)
+#define ADAPTIVE_RTO TRUE
+#define RTO_MIN_MS 20
+#define RTO_MAX_MS 60000
+// Bits por byte na linha (start, 8 bits de dados, stop), para calcular quando uma trama acaba de sair
+#define BITS_PER_BYTE 10
+
+// Histograma dos RTT nas estatísticas: intervalos de [2^(i-1), 2^i) ms
+#define RTT_BUCKETS 16
+
+// Tamanho das tramas adaptado à taxa de erros: ao fim de cada ADAPT_FRAMES tramas novas o emissor estima
+// o BER a partir dos REJ, SREJ e timeouts e aproxima o tamanho recomendado dos dados do que maximiza o débito útil
+#define ADAPTIVE_FRAME_SIZE TRUE
+#define ADAPT_FRAMES 32
+// A esta fração do ótimo o tamanho vai logo para ele, e só se mostram as mudanças maiores do que ela
+// (perto do ótimo o tamanho ainda mexe uns bytes de janela para janela)
+#define ADAPT_MARGIN 0.05
+// bytes por trama além dos dados: FLAG, A, C, BCC1, BCC2, FLAG, a resposta RR (5) e o cabeçalho do pacote (3).
+// Com um CRC somam-se os bytes do campo de verificação além do primeiro
+#define FRAME_OVERHEAD 14
+
+// Modo de recuperação de erros proposto no SET
+#define ARQ_GO_BACK_N 0
+#define ARQ_SELECTIVE 1
+#define ARQ_MODE ARQ_GO_BACK_N
+
+// Campo de verificação dos dados das tramas I proposto no SET (CHECK_BCC, CHECK_CRC16 ou CHECK_CRC32C):
+// fica o mais fraco dos dois lados, e o BCC2 de 1 byte com quem não conhece o parâmetro.
+// O CRC é calculado na mesma passagem do stuffing e do destuffing
+#define FRAME_CHECK CHECK_CRC32C
+
+// Correção de erros (FEC) proposta no SET: bytes de paridade Reed-Solomon por bloco de 255 bytes do campo de
+// informação (par, até RS_MAX_PARITY), que corrigem metade desse número de bytes errados por bloco sem
+// retransmissão. 0 desliga; fica o menor dos dois lados, e desligada com quem não conhece o parâmetro.
+// Compensa em linhas longas e com ruído: com 16 a trama cresce 7% e aguenta 8 bytes errados em cada 239
+#define FEC_PARITY 0
+
+// Parâmetros negociados no SET/UA (T, L, V)
+#define PARAM_WINDOW 0x01
+#define PARAM_ARQ 0x02
+#define PARAM_MAX_INFO 0x03
+#define PARAM_CHECK 0x04
+#define PARAM_FEC 0x05
+#define MAX_PARAMS_SIZE 32
+
+// Buffer de receção: os bytes chegam da porta série em blocos (um read() por bloco)
+// e as máquinas de estados consomem-nos daqui
+#define RX_BUF_SIZE 4096
+
+// Estado de uma ligação: tudo o que é preciso para servir uma porta série
+struct LinkSession {
+    LinkLayer connectionParameters;
+    int fd;
+    int established;
+    int link_down; // a porta série fechou (o outro lado desligou) ou deu erro
+
+    // Temporizador de retransmissão (timerfd), esperado com poll() juntamente com a porta série
+    int timer_fd;
+    int timeout_ms;
+
+    // Estimativa do RTT (ms) e timeout de retransmissão atual das tramas I
+    double srtt;
+    double rttvar;
+    double rto;
+
+    // Instante previsto em que a fila de saída da porta série fica vazia
+    struct timespec tx_idle_at;
+
+    int Ns;
+    int Nr;
+
+    // Parâmetros da ligação (por omissão stop-and-wait, compatível com SET/UA sem parâmetros)
+    int window_size;
+    int seq_mod;
+    int arq_mode;
+    int params_received;
+    int max_info;  // tamanho máximo acordado do campo de informação
+    int max_frame; // tamanho máximo de uma trama I com stuffing
+    int frame_check; // campo de verificação das tramas I (CHECK_BCC, CHECK_CRC16 ou CHECK_CRC32C)
+    int fec_parity;  // bytes de paridade Reed-Solomon por bloco do campo de informação (0 sem FEC)
+
+    // Bloco com os buffers das tramas (janela, reordenação e llread), reservado com o tamanho acordado
+    unsigned char *buffers;
+
+    // Janela de transmissão: tramas enviadas e ainda sem confirmação, indexadas pelo número de sequência,
+    // cada uma com o seu temporizador (instante em que o último envio acabou de sair pela UART) e número de reenvios
+    unsigned char *window_frames[SEQ_MOD_WINDOW];
+    int window_lengths[SEQ_MOD_WINDOW];
+    struct timespec window_sent_at[SEQ_MOD_WINDOW];
+    int window_retries[SEQ_MOD_WINDOW];
+    int window_sends[SEQ_MOD_WINDOW]; // envios de cada trama (regra de Karn: só se mede o RTT das enviadas uma vez)
+    int window_base;  // número de sequência da trama mais antiga por confirmar
+    int window_count; // número de tramas por confirmar
+
+    // O recetor só envia um REJ por cada falha de sequência
+    int reject_sent;
+
+    // Buffer de reordenação do recetor (Selective Repeat): tramas recebidas à frente de Nr
+    unsigned char *rx_frames[SEQ_MOD_WINDOW];
+    int rx_lengths[SEQ_MOD_WINDOW];
+    int rx_received[SEQ_MOD_WINDOW];
+    int srej_sent[SEQ_MOD_WINDOW];
+    int next_deliver; // próxima trama a entregar à camada de aplicação (Nr quando o buffer está vazio)
+
+    // Trama I recebida, com e sem stuffing
+    unsigned char *stuffed_frame;
+    unsigned char *destuffed_frame;
+
+    // Com FEC: dados e campo de verificação por codificar (emissor), e campo de informação codificado
+    unsigned char *fec_data;
+    unsigned char *fec_coded;
+
+    // Estatísticas
+    struct timespec start, end;
+    unsigned long total_bytes_sent;
+    unsigned long total_bytes_received;
+    unsigned long frames_sent;
+    unsigned long frames_retransmitted;
+    unsigned long frames_received;
+    unsigned long frames_rejected;
+    unsigned long fec_frames_corrected;
+    unsigned long fec_bytes_corrected;
+    unsigned long frames_duplicated;
+    unsigned long frames_buffered;
+    unsigned long rej_count;
+    unsigned long srej_count;
+    unsigned long timeout_count;
+    unsigned long frames_parsed;
+    unsigned long read_calls;
+    unsigned long rtt_samples;
+    double rtt_min, rtt_max, rtt_sum;
+    unsigned long rtt_histogram[RTT_BUCKETS];
+
+    // Tamanho recomendado dos dados (adaptado à taxa de erros) e medições da janela de adaptação atual
+    int payload_size;
+    int adapt_frames;
+    unsigned long adapt_bytes;
+    unsigned long adapt_errors_base;
+    double fer;
+    double ber_estimate;
+    unsigned long payload_adjustments;
+
+    unsigned char rx_buf[RX_BUF_SIZE];
+    int rx_pos;
+    int rx_len;
+};
+
+// Sessão usada pela interface clássica (llopen/llwrite/llread/llclose)
+LinkSession *default_session = NULL;
+
+// Marca a ligação como perdida (a porta fechou ou deu erro): as esperas deixam de tentar de novo.
+// Retorna -1
+int link_lost(LinkSession *session) {
+    if (!session->link_down) printf("Error: serial port closed!\n");
+    session->link_down = TRUE;
+    return -1;
+}
 
-int alarmEnabled = FALSE;
-int alarmCount = 0;
+// Enche o buffer de receção com um só read() quando está vazio.
+// Espera (sem gastar CPU) até haver bytes na porta série ou o temporizador expirar.
+// Retorna o número de bytes disponíveis, 0 em timeout ou -1 em caso de erro (porta fechada ou com erro)
+int rx_fill(LinkSession *session) {
+    if (session->rx_pos < session->rx_len) return session->rx_len - session->rx_pos;
+    if (session->link_down) return -1;
+
+    struct pollfd pfds[2] = {
+        { session->fd, POLLIN, 0 },
+        { session->timer_fd, POLLIN, 0 },
+    };
+    if (poll(pfds, 2, -1) < 0) {
+        return (errno == EINTR) ? 0 : link_lost(session);
+    }
 
-int Ns = 0;
-int Nr = 0;
+    if (pfds[0].revents == 0) {
+        // Só o temporizador expirou: limpa-o e reporta timeout
+        uint64_t expirations;
+        if (read(session->timer_fd, &expirations, sizeof(expirations)) < 0) return 0;
+        return 0;
+    }
+    // Sem bytes para ler, só erro ou fim da ligação
+    if (!(pfds[0].revents & POLLIN)) return link_lost(session);
+
+    session->read_calls++;
+    int res = read(session->fd, session->rx_buf, RX_BUF_SIZE);
+    session->rx_pos = 0;
+    session->rx_len = (res > 0) ? res : 0;
+    if (res < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+    if (res <= 0) return link_lost(session);
+    return res;
+}
 
+// Lê um byte do buffer de receção. Retorna 1 em caso de sucesso, 0 em timeout ou -1 em caso de erro
+int read_byte(LinkSession *session, unsigned char *byte) {
+    int res = rx_fill(session);
+    if (res <= 0) return res;
+    *byte = session->rx_buf[session->rx_pos++];
+    return 1;
+}
 
-// Calcula o tamanho do frame, se e só se a frame começar e acabar com uma FLAG
-int get_frame_length(unsigned char *frame) {
-    int first_FLAG= 0;
-    int last_FLAG = 0;
-    
-    // Encontra a primeira FLAG
-    for (int i = 0; i < MAX_BUF_SIZE; i++) {
-        if (frame[i] == FLAG) {
-            first_FLAG = i;
-            break;
-        }
-    }
-    
-    // Encontra a ultima FLAG
-    for (int i = MAX_BUF_SIZE - 1; i > first_FLAG; i--) {
-        if (frame[i] == FLAG) {
-            last_FLAG = i;
-            break;
-        }
-    }
+// Descarta os bytes já recebidos até à próxima FLAG (que fica por ler)
+void skip_to_flag(LinkSession *session) {
+    unsigned char *flag = memchr(&session->rx_buf[session->rx_pos], FLAG, session->rx_len - session->rx_pos);
+    session->rx_pos = flag ? (int)(flag - session->rx_buf) : session->rx_len;
+}
+
+// Copia para dest os bytes já recebidos até à próxima FLAG (que fica por ler), no máximo max bytes.
+// Retorna o número de bytes copiados
+int copy_to_flag(LinkSession *session, unsigned char *dest, int max) {
+    int available = session->rx_len - session->rx_pos;
+    if (available > max) available = max;
+    if (available <= 0) return 0;
+
+    unsigned char *flag = memchr(&session->rx_buf[session->rx_pos], FLAG, available);
+    int size = flag ? (int)(flag - &session->rx_buf[session->rx_pos]) : available;
+    memcpy(dest, &session->rx_buf[session->rx_pos], size);
+    session->rx_pos += size;
+    return size;
+}
 
-    return last_FLAG - first_FLAG + 1;
+// Escreve um frame com o tamanho dado
+int write_frame(LinkSession *session, const unsigned char *frame, int length) {
+    int written = write(session->fd, frame, length);
+    return written;
 }
 
-// Escreve um frame
-int write_frame(unsigned char *frame) {
-    int frame_Size = get_frame_length(frame);
-    int written = write(global_fd, frame, frame_Size);
+// Escreve uma trama de controlo (SET, UA, DISC, RR, REJ ou SREJ) e espera que saia pela porta série,
+// em vez de esperar um tempo fixo
+int write_control(LinkSession *session, const unsigned char *frame, int length) {
+    int written = write_frame(session, frame, length);
+    tcdrain(session->fd);
     return written;
 }
 
@@ -124,13 +343,194 @@ void print_array(unsigned char *argv, int size)
     printf("\n");
 }
 
-// Função que trata do sinal de alarme
-void alarmHandler(int signal)
-{
-    if (ESTABLISHMENT == FALSE) {
-        alarmEnabled = FALSE;
-        alarmCount++;
+// Posição do número de sequência no campo de controlo
+// (stop-and-wait: bit 6 nas tramas I e bit 7 em RR/REJ; Go-Back-N: bits 5 a 7)
+int seq_shift_I(LinkSession *session) {
+    return (session->seq_mod == 2) ? 6 : 5;
+}
+
+int seq_shift_S(LinkSession *session) {
+    return (session->seq_mod == 2) ? 7 : 5;
+}
+
+// Campos de controlo das tramas I, RR, REJ e SREJ com número de sequência n
+unsigned char control_I(LinkSession *session, int n) {
+    return (unsigned char)(n << seq_shift_I(session));
+}
+
+unsigned char control_RR(LinkSession *session, int n) {
+    return (unsigned char)((n << seq_shift_S(session)) | C_RR_0);
+}
+
+unsigned char control_REJ(LinkSession *session, int n) {
+    return (unsigned char)((n << seq_shift_S(session)) | C_REJ_0);
+}
+
+unsigned char control_SREJ(LinkSession *session, int n) {
+    return (unsigned char)((n << seq_shift_S(session)) | C_SREJ_0);
+}
+
+// Número de sequência de uma trama I ou de uma resposta RR/REJ
+int seq_I(LinkSession *session, unsigned char c) {
+    return c >> seq_shift_I(session);
+}
+
+int seq_S(LinkSession *session, unsigned char c) {
+    return c >> seq_shift_S(session);
+}
+
+// Verifica se o campo de controlo é de uma trama I válida no modo negociado
+int is_control_I(LinkSession *session, unsigned char c) {
+    return seq_I(session, c) < session->seq_mod && control_I(session, seq_I(session, c)) == c;
+}
+
+// Verifica se o campo de controlo é de um RR, REJ ou SREJ válido no modo negociado
+int is_control_reply(LinkSession *session, unsigned char c) {
+    int n = seq_S(session, c);
+    if (n >= session->seq_mod) return 0;
+    if (session->arq_mode == ARQ_SELECTIVE && control_SREJ(session, n) == c) return 1;
+    return control_RR(session, n) == c || control_REJ(session, n) == c;
+}
+
+// Maior campo de informação que este lado aceita: MAX_INFO_SIZE, limitado ao que sai em MAX_FRAME_TIME_MS ao
+// baudRate configurado (nunca abaixo do tamanho base)
+int max_info_local(LinkSession *session) {
+    long bytes = (long)session->connectionParameters.baudRate * MAX_FRAME_TIME_MS / 1000 / BITS_PER_BYTE;
+    if (bytes > MAX_INFO_SIZE) bytes = MAX_INFO_SIZE;
+    if (bytes < DEFAULT_INFO_SIZE) bytes = DEFAULT_INFO_SIZE;
+    return (int)bytes;
+}
+
+// Aplica os parâmetros propostos pelo outro lado (fica a menor das janelas, dos campos de informação e da
+// paridade do FEC e a verificação mais fraca). Em Selective Repeat a janela não pode passar de metade do módulo
+void set_link_params(LinkSession *session, int window, int arq, int max_info, int check, int fec) {
+    session->window_size = (window < WINDOW_SIZE) ? window : WINDOW_SIZE;
+    if (session->window_size < 1) session->window_size = 1;
+    session->arq_mode = (arq == ARQ_SELECTIVE && session->window_size > 1) ? ARQ_SELECTIVE : ARQ_GO_BACK_N;
+    if (session->arq_mode == ARQ_SELECTIVE && session->window_size > SEQ_MOD_WINDOW / 2) {
+        session->window_size = SEQ_MOD_WINDOW / 2;
     }
+    session->seq_mod = (session->window_size > 1) ? SEQ_MOD_WINDOW : 2;
+
+    int local_max = max_info_local(session);
+    session->max_info = (max_info < local_max) ? max_info : local_max;
+    if (session->max_info < MIN_INFO_SIZE) session->max_info = MIN_INFO_SIZE;
+
+    session->frame_check = (check < FRAME_CHECK) ? check : FRAME_CHECK;
+    if (check_size(session->frame_check) == 0) session->frame_check = CHECK_BCC;
+
+    session->fec_parity = ((fec < FEC_PARITY) ? fec : FEC_PARITY) & ~1;
+    if (session->fec_parity < 0 || session->fec_parity > RS_MAX_PARITY) session->fec_parity = 0;
+}
+
+// Reserva os buffers das tramas para o tamanho acordado.
+// Retorna 0 em caso de sucesso e -1 em caso de erro
+int alloc_buffers(LinkSession *session) {
+    // o tamanho adaptado começa no tamanho base e só cresce sem erros
+    session->payload_size = (DEFAULT_INFO_SIZE < session->max_info) ? DEFAULT_INFO_SIZE : session->max_info;
+    session->max_frame = STUFFED_FRAME_SIZE(session->max_info);
+    int fec_size = 0;
+    if (session->fec_parity > 0) {
+        // com FEC a paridade dos dados e do campo de verificação também passa pelo stuffing
+        int coded = rs_encoded_size(session->max_info + CHECK_MAX_SIZE, session->fec_parity);
+        session->max_frame += 2 * (coded - session->max_info - CHECK_MAX_SIZE);
+        fec_size = session->max_info + CHECK_MAX_SIZE + session->max_frame;
+    }
+    size_t size = (size_t)session->seq_mod * (session->max_frame + session->max_info) + 2 * session->max_frame + fec_size;
+    session->buffers = malloc(size);
+    if (session->buffers == NULL) {
+        printf("Error: out of memory!\n");
+        return -1;
+    }
+
+    unsigned char *next = session->buffers;
+    for (int i = 0; i < session->seq_mod; i++) {
+        session->window_frames[i] = next;
+        next += session->max_frame;
+    }
+    for (int i = 0; i < session->seq_mod; i++) {
+        session->rx_frames[i] = next;
+        next += session->max_info;
+    }
+    session->stuffed_frame = next;
+    session->destuffed_frame = next + session->max_frame;
+    next += 2 * session->max_frame;
+    if (session->fec_parity > 0) {
+        session->fec_data = next;
+        session->fec_coded = next + session->max_info + CHECK_MAX_SIZE;
+    }
+    return 0;
+}
+
+// Tempo decorrido (em milissegundos) desde o instante dado
+double elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1E3 + (now.tv_nsec - since->tv_nsec) / 1E6;
+}
+
+// Avança o instante t em ms milissegundos
+void add_ms(struct timespec *t, double ms) {
+    long long ns = t->tv_nsec + (long long)(ms * 1E6);
+    t->tv_sec += ns / 1000000000;
+    t->tv_nsec = ns % 1000000000;
+}
+
+// Verifica se o instante a é anterior ao instante b
+int time_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// Arma o temporizador da sessão para expirar ms milissegundos depois do instante since
+void arm_timer(LinkSession *session, const struct timespec *since, double ms) {
+    struct itimerspec deadline = {0};
+    deadline.it_value = *since;
+    add_ms(&deadline.it_value, ms);
+    timerfd_settime(session->timer_fd, TFD_TIMER_ABSTIME, &deadline, NULL);
+}
+
+// Arma o temporizador para daqui a ms milissegundos
+void start_timer(LinkSession *session, double ms) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    arm_timer(session, &now, ms);
+}
+
+// Regista uma medição do RTT (ms) e atualiza o SRTT, o RTTVAR e o RTO (RFC 6298)
+void rtt_sample(LinkSession *session, double rtt) {
+    if (session->rtt_samples == 0 || rtt < session->rtt_min) session->rtt_min = rtt;
+    if (rtt > session->rtt_max) session->rtt_max = rtt;
+    session->rtt_sum += rtt;
+    int bucket = 0;
+    while (bucket < RTT_BUCKETS - 1 && rtt >= (1 << bucket)) bucket++;
+    session->rtt_histogram[bucket]++;
+
+    if (session->rtt_samples++ == 0) {
+        session->srtt = rtt;
+        session->rttvar = rtt / 2;
+    } else {
+        double error = (rtt > session->srtt) ? rtt - session->srtt : session->srtt - rtt;
+        session->rttvar = 0.75 * session->rttvar + 0.25 * error;
+        session->srtt = 0.875 * session->srtt + 0.125 * rtt;
+    }
+
+    if (!ADAPTIVE_RTO) return;
+    session->rto = session->srtt + 4 * session->rttvar;
+    if (session->rto < RTO_MIN_MS) session->rto = RTO_MIN_MS;
+    if (session->rto > RTO_MAX_MS) session->rto = RTO_MAX_MS;
+}
+
+// Depois de um timeout o RTO duplica até chegar uma nova medição
+void rto_backoff(LinkSession *session) {
+    if (!ADAPTIVE_RTO) return;
+    session->rto *= 2;
+    if (session->rto > RTO_MAX_MS) session->rto = RTO_MAX_MS;
+}
+
+// Desarma o temporizador: as leituras esperam até chegarem bytes
+void stop_timer(LinkSession *session) {
+    struct itimerspec never = {0};
+    timerfd_settime(session->timer_fd, 0, &never, NULL);
 }
 
 // Função que calcula o BCC2
@@ -142,95 +542,219 @@ int get_BCC2(const unsigned char *argv, int size){
     return BCC2;
 }
 
-// Função de byte stuffing
-unsigned char* byte_stuffing(unsigned char *frame, int inputLength) {
-    static unsigned char stuffed[MAX_BUF_SIZE];
-    memset(stuffed, 0, MAX_BUF_SIZE); // Dá clear ao buffer (evitar "lixo")
-    int i, j = 0;
+// Codifica uma trama (FLAG, A, C, BCC1, dados, campo de verificação, FLAG) já com stuffing diretamente em out.
+// Os dados são lidos uma só vez: o campo de verificação (check) é calculado enquanto o stuffing os copia.
+// out tem de ter espaço para STUFFED_FRAME_SIZE(size) bytes. Retorna o tamanho da trama em out
+int encode_frame(unsigned char *out, unsigned char a, unsigned char c, const unsigned char *data, int size, int check) {
+    const unsigned char header[3] = { a, c, a ^ c };
+    uint32_t crc = check_init(check);
+    unsigned char fcs[CHECK_MAX_SIZE];
+    unsigned char unused = 0;
+    int j = 0;
+
+    out[j++] = FLAG;
+    j += stuff_bytes(&out[j], header, 3, &unused);
+    j += stuff_bytes_check(&out[j], data, size, check, &crc);
+    j += stuff_bytes(&out[j], fcs, check_final(check, crc, fcs), &unused);
+    out[j++] = FLAG;
+    return j;
+}
+
+// Codifica uma trama I com FEC (FLAG, A, C, BCC1, dados e campo de verificação codificados, FLAG) em out, que tem
+// de ter espaço para session->max_frame bytes: o campo de verificação cobre os dados originais, para o recetor
+// confirmar as correções. Retorna o tamanho da trama em out
+int encode_frame_fec(LinkSession *session, unsigned char *out, unsigned char a, unsigned char c, const unsigned char *data, int size) {
+    const unsigned char header[3] = { a, c, a ^ c };
+    unsigned char unused = 0;
+    int check = session->frame_check;
+
+    memcpy(session->fec_data, data, size);
+    uint32_t crc = check_update(check, check_init(check), data, size);
+    size += check_final(check, crc, &session->fec_data[size]);
+    int coded = rs_encode(session->fec_coded, session->fec_data, size, session->fec_parity);
+
+    int j = 0;
+    out[j++] = FLAG;
+    j += stuff_bytes(&out[j], header, 3, &unused);
+    j += stuff_bytes(&out[j], session->fec_coded, coded, &unused);
+    out[j++] = FLAG;
+    return j;
+}
 
-    stuffed[j++] = frame[0];
-    for (i = 1; i < inputLength - 1; i++) {
-        if (frame[i] == FLAG || frame[i] == ESCAPE) {
-            stuffed[j++] = ESCAPE;
-            stuffed[j++] = frame[i] ^ 0x20;
+// Desfaz o stuffing de uma trama I (FLAG, A, C, BCC1, dados, campo de verificação, FLAG) com size bytes para
+// destuffed (FLAG, A, C, BCC1 e os dados a partir da posição 4), verificando os dados na mesma passagem.
+// O cabeçalho tem o seu BCC1 e fica fora da verificação, como no BCC2.
+// Retorna o tamanho dos dados (*valid == TRUE se estiverem corretos e couberem no campo de informação)
+int decode_frame(LinkSession *session, const unsigned char *stuffed, int size, unsigned char *destuffed, int *valid) {
+    int check = session->frame_check;
+    int i = 1, j = 0;
+
+    destuffed[j++] = stuffed[0];
+    while (j < 4 && i < size - 1) {
+        if (stuffed[i] == ESCAPE && i + 2 < size) {
+            destuffed[j++] = stuffed[i + 1] ^ 0x20;
+            i += 2;
         } else {
-            stuffed[j++] = frame[i];
+            destuffed[j++] = stuffed[i++];
         }
     }
 
-    stuffed[j] = frame[inputLength - 1];
-    return stuffed;
+    uint32_t crc = check_init(check);
+    if (session->fec_parity == 0) {
+        j += destuff_bytes_check(&destuffed[j], &stuffed[i], size - 1 - i, check, &crc);
+        int payload_size = j - 4 - check_size(check);
+        *valid = check_valid(check, crc) && payload_size > 0 && payload_size <= session->max_info;
+        return payload_size;
+    }
+
+    // Com FEC corrige primeiro e só depois verifica (o campo de verificação apanha uma correção errada)
+    int coded = destuff_bytes(session->fec_coded, &stuffed[i], size - 1 - i);
+    int length = rs_decoded_size(coded, session->fec_parity);
+    int corrected = rs_decode(&destuffed[j], session->fec_coded, coded, session->fec_parity);
+    crc = check_update(check, crc, &destuffed[j], length);
+    int payload_size = length - check_size(check);
+    *valid = corrected >= 0 && check_valid(check, crc) && payload_size > 0 && payload_size <= session->max_info;
+    if (*valid && corrected > 0) {
+        session->fec_frames_corrected++;
+        session->fec_bytes_corrected += corrected;
+    }
+    return payload_size;
 }
 
-// Função de byte destuffing
-unsigned char* byte_destuffing(unsigned char *argv, int inputLength) {
-    static unsigned char destuffed[BUF_SIZE] = {0};
-    memset(destuffed, 0, BUF_SIZE); // Dá clear ao buffer (evitar "lixo")
-    int i, j = 0;
+// Função que envia SET/UA com os parâmetros da ligação (FLAG, A, C, BCC1, parâmetros, BCC2, FLAG).
+// Com proposal == TRUE envia os valores máximos locais, senão os valores acordados
+void send_params(LinkSession *session, unsigned char a, unsigned char c, int proposal){
+    unsigned char params[MAX_PARAMS_SIZE];
+    int index = 0;
+    params[index++] = PARAM_WINDOW;
+    params[index++] = 1;
+    params[index++] = proposal ? WINDOW_SIZE : session->window_size;
+    params[index++] = PARAM_ARQ;
+    params[index++] = 1;
+    params[index++] = proposal ? ARQ_MODE : session->arq_mode;
+    int max_info = proposal ? max_info_local(session) : session->max_info;
+    params[index++] = PARAM_MAX_INFO;
+    params[index++] = 2;
+    params[index++] = (max_info >> 8) & 0xFF;
+    params[index++] = max_info & 0xFF;
+    params[index++] = PARAM_CHECK;
+    params[index++] = 1;
+    params[index++] = proposal ? FRAME_CHECK : session->frame_check;
+    params[index++] = PARAM_FEC;
+    params[index++] = 1;
+    params[index++] = proposal ? FEC_PARITY : session->fec_parity;
+
+    // os parâmetros vão sempre com o BCC2 (ainda não há verificação acordada)
+    unsigned char frame[STUFFED_FRAME_SIZE(MAX_PARAMS_SIZE)];
+    int length = encode_frame(frame, a, c, params, index, CHECK_BCC);
+    write_control(session, frame, length);
+}
 
-    destuffed[j++] = argv[0];
-    for (i = 1; i < inputLength - 1; i++) {
-        if (argv[i] == ESCAPE) {
-            i++;
-            destuffed[j++] = argv[i] ^ 0x20;
-        } else {
-            destuffed[j++] = argv[i];
+// Lê o resto de um SET/UA com parâmetros, depois de receber o primeiro byte dos parâmetros.
+// Retorna 0 em caso de erro e 1 em caso de sucesso
+int read_params(LinkSession *session, unsigned char first) {
+    unsigned char stuffed[2 * MAX_PARAMS_SIZE] = {0};
+    unsigned char buf = first;
+    int size = 0;
+
+    // Lê até à FLAG final
+    while (buf != FLAG) {
+        if (size >= (int)sizeof(stuffed)) return 0;
+        stuffed[size++] = buf;
+        size += copy_to_flag(session, &stuffed[size], (int)sizeof(stuffed) - size);
+        if (read_byte(session, &buf) <= 0) return 0;
+    }
+
+    // Destuffing dos parâmetros e do BCC2
+    unsigned char params[2 * MAX_PARAMS_SIZE];
+    int length = destuff_bytes(params, stuffed, size);
+    if (length < 2 || get_BCC2(params, length - 1) != params[length - 1]) return 0;
+
+    // Interpreta os parâmetros (T, L, V), ignorando os desconhecidos
+    int window = 1;
+    int arq = ARQ_GO_BACK_N;
+    int max_info = DEFAULT_INFO_SIZE;
+    int check = CHECK_BCC;
+    int fec = 0;
+    int index = 0;
+    while (index + 2 <= length - 1) {
+        int type = params[index];
+        int len = params[index + 1];
+        index += 2;
+        if (index + len > length - 1) return 0;
+        if (type == PARAM_WINDOW && len == 1) {
+            window = params[index];
+        } else if (type == PARAM_ARQ && len == 1) {
+            arq = params[index];
+        } else if (type == PARAM_MAX_INFO && len == 2) {
+            max_info = (params[index] << 8) | params[index + 1];
+        } else if (type == PARAM_CHECK && len == 1) {
+            check = params[index];
+        } else if (type == PARAM_FEC && len == 1) {
+            fec = params[index];
         }
+        index += len;
     }
+    set_link_params(session, window, arq, max_info, check, fec);
 
-    destuffed[j] = argv[inputLength - 1];
-    return destuffed;
+    session->params_received = TRUE;
+    session->frames_parsed++;
+    return 1;
 }
 
-// Função que envia SET
-void send_SET(int fd){
+// Função que envia SET (com parâmetros se os valores propostos não forem os antigos, a não ser que plain == TRUE)
+void send_SET(LinkSession *session, int plain){
+    int defaults = (WINDOW_SIZE == 1 && max_info_local(session) == DEFAULT_INFO_SIZE && FRAME_CHECK == CHECK_BCC && FEC_PARITY == 0);
+    if (!plain && !defaults) {
+        send_params(session, A_SET, C_SET, TRUE);
+        return;
+    }
+    if (plain && !defaults) {
+        // Um recetor antigo que rejeitou o SET com parâmetros ficou à espera de A depois da FLAG final dele:
+        // um byte de enchimento (que não é FLAG nem A) faz com que leia este SET desde o início
+        const unsigned char FILL_SET[BUF_SIZE_SET + 1] = {0x00, FLAG, A_SET, C_SET, BCC1_SET, FLAG};
+        write_control(session, FILL_SET, BUF_SIZE_SET + 1);
+        return;
+    }
     const unsigned char SET_FRAME[BUF_SIZE_SET] = {FLAG, A_SET, C_SET, BCC1_SET, FLAG};
-    write(fd, SET_FRAME, BUF_SIZE_SET);
-    sleep(sleep_time);
+    write_control(session, SET_FRAME, BUF_SIZE_SET);
 }
 
-// Função que envia UA
-void send_UA(int fd){
+// Função que envia UA (com os parâmetros acordados se o SET os trouxe)
+void send_UA(LinkSession *session){
+    if (session->params_received && session->established == FALSE) {
+        send_params(session, A_UA, C_UA, FALSE);
+        return;
+    }
     const unsigned char UA_FRAME[BUF_SIZE_UA] = {FLAG, A_UA, C_UA, BCC1_UA, FLAG};
-    write(fd, UA_FRAME, BUF_SIZE_UA);
-    sleep(sleep_time);
+    write_control(session, UA_FRAME, BUF_SIZE_UA);
 }
 
 // Função que envia DISC
-void send_DISC(int fd){
+void send_DISC(LinkSession *session){
     const unsigned char DISC_FRAME[BUF_SIZE_DISC] = {FLAG, A_DISC, C_DISC, BCC1_DISC, FLAG};
-    write(fd, DISC_FRAME, BUF_SIZE_DISC);
-    sleep(sleep_time);
-}
-
-// Função que envia Reply (RR0, RR1, REJ0, REJ1)
-void send_reply(int fd, int reply){
-    if(reply == C_RR_0){
-        const unsigned char RR0_FRAME[BUF_SIZE_REPLY] = { FLAG, A, C_RR_0, BCC1_RR_0, FLAG };
-        write(fd, RR0_FRAME, BUF_SIZE_REPLY);
-        sleep(sleep_time);
-    }else if(reply == C_RR_1){
-        const unsigned char RR1_FRAME[BUF_SIZE_REPLY] = { FLAG, A, C_RR_1, BCC1_RR_1, FLAG };
-        write(fd, RR1_FRAME, BUF_SIZE_REPLY);
-        sleep(sleep_time);
-    }else if(reply == C_REJ_0){
-        const unsigned char REJ0_FRAME[BUF_SIZE_REPLY] = { FLAG, A, C_REJ_0, BCC1_REJ_0, FLAG };
-        write(fd, REJ0_FRAME, BUF_SIZE_REPLY);
-        sleep(sleep_time);
-    }else if(reply == C_REJ_1){
-        const unsigned char REJ1_FRAME[BUF_SIZE_REPLY] = { FLAG, A, C_REJ_1, BCC1_REJ_1, FLAG };
-        write(fd, REJ1_FRAME, BUF_SIZE_REPLY);
-        sleep(sleep_time);
-    }
-}  
+    write_control(session, DISC_FRAME, BUF_SIZE_DISC);
+}
+
+// Função que envia Reply (RR, REJ ou SREJ, com o campo de controlo dado por control_RR/control_REJ/control_SREJ)
+void send_reply(LinkSession *session, int reply){
+    const unsigned char REPLY_FRAME[BUF_SIZE_REPLY] = { FLAG, A_REPLY, reply, A_REPLY ^ reply, FLAG };
+    write_control(session, REPLY_FRAME, BUF_SIZE_REPLY);
+}
+
+// Estado a seguir a um byte inesperado a meio de uma trama: uma FLAG pode ser a inicial da trama seguinte (a
+// anterior veio truncada ou foi descartada), por isso a leitura continua a partir dela em vez de a perder
+int resync_state(unsigned char buf) {
+    return (buf == FLAG) ? 1 : 0;
+}
 
 // Função que lê SET. Retorna 0 em caso de erro e 1 em caso de sucesso
-int read_SET(int fd) {
+int read_SET(LinkSession *session) {
     unsigned char buf;
     int state = 0;
 
     while (state < BUF_SIZE_SET) {
-        int bytesRead = read(fd, &buf, 1);
+        int bytesRead = read_byte(session, &buf);
         if (bytesRead <= 0) return 0;
 
         switch (state) {
@@ -245,33 +769,34 @@ int read_SET(int fd) {
             case 1: 
                 if (buf == A_SET){ 
                     state = 2; 
-                } else{
-                    state = 0;
-                    return 0;
+                } else {
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 2: 
                 if (buf == C_SET){
                     state = 3;
-                } else{
-                    state = 0;
-                    return 0;
+                } else {
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 3: 
                 if (buf == (BCC1_SET)){
                     state = 4; 
-                } else{
-                    state = 0;
-                    return 0;
+                } else {
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 4: 
                 if (buf == FLAG){
+                    session->frames_parsed++;
                     return 1; 
                 } else{
-                    state = 0;
-                    return 0;
+                    // SET com parâmetros da ligação
+                    return read_params(session, buf);
                 }
                 break;
         }
@@ -280,12 +805,12 @@ int read_SET(int fd) {
 }
 
 // Função que lê UA. Retorna 0 em caso de erro e 1 em caso de sucesso
-int read_UA(int fd){
+int read_UA(LinkSession *session){
     unsigned char buf;
     int state = 0;
     while (state < BUF_SIZE_UA) {
 
-        int bytesRead = read(fd, &buf, 1);
+        int bytesRead = read_byte(session, &buf);
         if (bytesRead <= 0) return 0;
 
         switch (state) {
@@ -301,32 +826,33 @@ int read_UA(int fd){
                 if (buf == A_UA){ 
                     state = 2; 
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 2: 
                 if (buf == C_UA){
                     state = 3;
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 3: 
                 if (buf == (BCC1_UA)){
                     state = 4; 
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 4: 
                 if (buf == FLAG){
+                    session->frames_parsed++;
                     return 1; 
                 } else {
-                    state = 0;
-                    return 0;
+                    // UA com os parâmetros acordados
+                    return read_params(session, buf);
                 }
                 break;
         }
@@ -335,12 +861,12 @@ int read_UA(int fd){
 }
 
 // Função que lê DISC. Retorna 0 em caso de erro e 1 em caso de sucesso
-int read_DISC(int fd){
+int read_DISC(LinkSession *session){
     unsigned char buf;
     int state = 0;
 
     while (state < BUF_SIZE_DISC) {
-        int bytesRead = read(fd, &buf, 1);
+        int bytesRead = read_byte(session, &buf);
         if (bytesRead <= 0) return 0;
 
         switch (state) {
@@ -356,32 +882,33 @@ int read_DISC(int fd){
                 if (buf == A_DISC){ 
                     state = 2; 
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 2: 
                 if (buf == C_DISC){
                     state = 3;
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 3: 
                 if (buf == (BCC1_DISC)){
                     state = 4; 
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
             case 4: 
                 if (buf == FLAG){
+                    session->frames_parsed++;
                     return 1; 
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
         }
@@ -389,15 +916,56 @@ int read_DISC(int fd){
     return 0;
 }
 
-// Função que lê Reply. Retorna 0 em caso de erro e (RR0, RR1, REJ0, REJ1) em caso de sucesso
-int read_Reply(int fd) {
+// Lê o resto de uma trama I nova (o cabeçalho já lido está em header) que chegou enquanto esta sessão espera
+// respostas: o outro lado já trocou de sentido. Se estiver correta é confirmada e fica guardada para o próximo
+// llread (como as tramas fora de ordem em Selective Repeat); senão o outro lado reenvia-a
+void buffer_I(LinkSession *session, const unsigned char *header) {
+    unsigned char *stuffed_frame = session->stuffed_frame;
+    unsigned char *destuffed_frame = session->destuffed_frame;
+    memcpy(stuffed_frame, header, 4);
+
+    // Dados, campo de verificação e FLAG final
+    int size = 4;
+    while (size < session->max_frame) {
+        unsigned char byte;
+        if (read_byte(session, &byte) <= 0) return;
+        stuffed_frame[size++] = byte;
+        if (byte == FLAG) break;
+        size += copy_to_flag(session, &stuffed_frame[size], session->max_frame - 1 - size);
+    }
+    if (stuffed_frame[size - 1] != FLAG) return;
+
+    int valid;
+    int payload_size = decode_frame(session, stuffed_frame, size, destuffed_frame, &valid);
+    if (payload_size <= 0) return;
+    if (!valid) {
+        session->frames_rejected++;
+        return;
+    }
+
+    memcpy(session->rx_frames[session->Nr], &destuffed_frame[4], payload_size);
+    session->rx_lengths[session->Nr] = payload_size;
+    session->rx_received[session->Nr] = TRUE;
+    session->frames_received++;
+    session->frames_parsed++;
+    session->Nr = (session->Nr + 1) % session->seq_mod;
+    session->reject_sent = FALSE;
+    send_reply(session, control_RR(session, session->Nr));
+}
+
+// Função que lê Reply. Retorna 0 em caso de erro e o campo de controlo (RR, REJ ou SREJ) em caso de sucesso.
+// Depois de uma troca de sentido podem chegar tramas I do outro lado enquanto esta sessão ainda espera respostas:
+// a trama Nr é guardada (buffer_I) e as outras já foram recebidas (perdeu-se o RR) e voltam a ser confirmadas
+// com RR(Nr), senão o outro lado ficava a reenviá-las até desistir
+int read_Reply(LinkSession *session) {
     unsigned char buf;
     int state = 0;
     unsigned char reply[BUF_SIZE_REPLY] = {0};
     int res =0;
+    int frame_I = FALSE;
 
     while (state < BUF_SIZE_REPLY) {
-        int bytesRead = read(fd, &buf, 1);
+        int bytesRead = read_byte(session, &buf);
         if (bytesRead <= 0) return 0;
 
         switch (state) {
@@ -416,41 +984,41 @@ int read_Reply(int fd) {
                     reply[state] = buf;
                     state = 2;
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
 
             case 2:
-                if (buf == C_RR_0) {
-                    reply[state] = buf;
-                    state = 3;
-                    res=C_RR_0;
-                } else if(buf == C_RR_1) {
-                    reply[state] = buf;
-                    state = 3;
-                    res=C_RR_1;
-                } else if(buf == C_REJ_0) {
+                if (is_control_reply(session, buf) || is_control_I(session, buf)) {
                     reply[state] = buf;
                     state = 3;
-                    res=C_REJ_0;
-                }else if(buf == C_REJ_1) {
-                    reply[state] = buf;
-                    state = 3;
-                    res=C_REJ_1;
+                    res = buf;
+                    frame_I = !is_control_reply(session, buf);
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
 
             case 3:
-                if (buf == (reply[1] ^ reply[2])) {
+                if (buf == (reply[1] ^ reply[2]) && frame_I) {
+                    int seq = seq_I(session, reply[2]);
+                    if (seq == session->Nr && session->next_deliver == session->Nr) {
+                        // Só uma trama guardada de cada vez (o llread entrega-a primeiro)
+                        reply[state] = buf;
+                        buffer_I(session, reply);
+                    } else if (session->frames_received > 0 && seq != session->Nr) {
+                        session->frames_duplicated++;
+                        send_reply(session, control_RR(session, session->Nr));
+                    }
+                    return 0;
+                } else if (buf == (reply[1] ^ reply[2])) {
                     reply[state] = buf;
                     state = 4;
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
 
@@ -458,10 +1026,11 @@ int read_Reply(int fd) {
                 if (buf == FLAG) {
                     reply[state] = buf;
                     state = 0;
+                    session->frames_parsed++;
                     return res;
                 } else {
-                    state = 0;
-                    return 0;
+                    state = resync_state(buf);
+                    if (state == 0) return 0;
                 }
                 break;
         }
@@ -469,15 +1038,16 @@ int read_Reply(int fd) {
     return 0;
 }
 
-// Função que lê I frame. Retorna 0 em caso de erro e o tamanho do frame em caso de sucesso
-int read_I(int fd, unsigned char *frame) {
+// Função que lê I frame (com stuffing) para frame, com espaço para max_frame bytes.
+// Retorna 0 em caso de erro e o tamanho do frame em caso de sucesso
+int read_I(LinkSession *session, unsigned char *frame) {
     unsigned char buf;
     int state = 0;
     int res;
     int dataIndex = 0;
 
-    while (state+dataIndex < MAX_BUF_SIZE) {
-        res = read(fd, &buf, 1);
+    while (state+dataIndex < session->max_frame) {
+        res = read_byte(session, &buf);
         if(res <= 0) return 0;
 
         switch (state) {
@@ -486,6 +1056,8 @@ int read_I(int fd, unsigned char *frame) {
                     frame[state] = buf;
                     state = 1;
                 } else {
+                    // Descarta de uma vez o lixo já recebido até à próxima FLAG
+                    skip_to_flag(session);
                     state = 0;
                 }
                 break;
@@ -495,20 +1067,16 @@ int read_I(int fd, unsigned char *frame) {
                     frame[state] = buf;
                     state = 2;
                 } else {
-                    state = 0;
+                    state = resync_state(buf);
                 }
                 break;
 
             case 2: 
-                if (buf == C_0) {
-                    frame[state] = buf;
-                    state = 3;
-
-                } else if (buf == C_1) {
+                if (is_control_I(session, buf)) {
                     frame[state] = buf;
                     state = 3;
                 } else {
-                    state = 0;
+                    state = resync_state(buf);
                 }
                 break;
 
@@ -516,8 +1084,8 @@ int read_I(int fd, unsigned char *frame) {
                 if (buf == (frame[1] ^ frame[2])) {  
                     frame[state] = buf;
                     state = 4;
-                }  else {
-                    state = 0;
+                } else {
+                    state = resync_state(buf);
                 }
                 break;
 
@@ -525,12 +1093,15 @@ int read_I(int fd, unsigned char *frame) {
                 if (buf == FLAG) {
                     frame[state + dataIndex] = buf;
                     res = state + dataIndex + 1;
+                    session->frames_parsed++;
                     state = 0;
                     dataIndex = 0;
                     return res;
                 } else {
                     frame[state + dataIndex] = buf;
                     dataIndex++;
+                    // Copia de uma vez os dados já recebidos até à FLAG final
+                    dataIndex += copy_to_flag(session, &frame[state + dataIndex], session->max_frame - 1 - state - dataIndex);
                 }
                 break;
         
@@ -543,22 +1114,53 @@ int read_I(int fd, unsigned char *frame) {
 ////////////////////////////////////////////////
 // LLOPEN
 ////////////////////////////////////////////////
-// Open a connection using the "port" parameters defined in struct linkLayer.
-// Return "1" on success or "-1" on error.
-int llopen(LinkLayer connectionParameters) {
+// Fecha a porta série e liberta uma sessão que não chegou a abrir
+LinkSession *open_failed(LinkSession *session) {
+    if (session->fd >= 0) close(session->fd);
+    if (session->timer_fd >= 0) close(session->timer_fd);
+    free(session->buffers);
+    free(session);
+    return NULL;
+}
+
+// Abre uma ligação numa nova sessão. Retorna a sessão ou NULL em caso de erro
+LinkSession *llopen_session(LinkLayer connectionParameters) {
+    LinkSession *session = calloc(1, sizeof(LinkSession));
+    if (session == NULL) {
+        printf("Error: out of memory!\n");
+        return NULL;
+    }
+
     // Interpretar os parametros de ligação (role, baudrate, etc)
-    global_fd = open(connectionParameters.serialPort, O_RDWR | O_NOCTTY);
-    if (global_fd < 0)
+    session->connectionParameters = connectionParameters;
+    session->timeout_ms = (TIMEOUT_MS > 0) ? TIMEOUT_MS : connectionParameters.timeout * 1000;
+    session->rto = session->timeout_ms;
+    session->max_info = DEFAULT_INFO_SIZE;
+    session->payload_size = DEFAULT_INFO_SIZE;
+    session->timer_fd = -1;
+    session->window_size = 1;
+    session->seq_mod = 2;
+    session->arq_mode = ARQ_GO_BACK_N;
+    session->frame_check = CHECK_BCC;
+    session->fd = open(connectionParameters.serialPort, O_RDWR | O_NOCTTY);
+    if (session->fd < 0)
     {
         perror(connectionParameters.serialPort);
-        return -1;
+        return open_failed(session);
+    }
+
+    session->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (session->timer_fd < 0)
+    {
+        perror("timerfd_create");
+        return open_failed(session);
     }
 
     struct termios oldtio, newtio;
-    if (tcgetattr(global_fd, &oldtio) == -1)
+    if (tcgetattr(session->fd, &oldtio) == -1)
     {
         perror("tcgetattr");
-        return -1;
+        return open_failed(session);
     }
     memset(&newtio, 0, sizeof(newtio));
 
@@ -571,7 +1173,7 @@ int llopen(LinkLayer connectionParameters) {
         case 115200: baud = B115200; break;
         default:
             printf("Invalid baud rate: %d\n", connectionParameters.baudRate);
-            return -1;
+            return open_failed(session);
     }
     newtio.c_cflag = baud | CS8 | CLOCAL | CREAD;
     newtio.c_iflag = IGNPAR;
@@ -579,223 +1181,744 @@ int llopen(LinkLayer connectionParameters) {
     newtio.c_lflag = 0;
     
 
-    newtio.c_cc[VTIME] = connectionParameters.timeout * 10;
+    // read() não bloqueia: a espera (e o timeout) é feita com poll() na porta e no temporizador
+    newtio.c_cc[VTIME] = 0;
     newtio.c_cc[VMIN] = 0;
 
-    tcflush(global_fd, TCIOFLUSH);
-    if (tcsetattr(global_fd, TCSANOW, &newtio) == -1)
+    tcflush(session->fd, TCIOFLUSH);
+    if (tcsetattr(session->fd, TCSANOW, &newtio) == -1)
     {
         perror("tcsetattr");
-        return -1;
+        return open_failed(session);
     }
 
     printf("\n 🐧 \n\n");
 
+    clock_gettime(CLOCK_MONOTONIC, &session->start); // Registra o tempo inicial
+
     if (connectionParameters.role == LlTx) {
         // Transmissor:
-        (void)signal(SIGALRM, alarmHandler);
-
-        // Envia SET
-        send_SET(global_fd);
-
-        // Lê UA
-        if (read_UA(global_fd) == 1) {
-            ESTABLISHMENT = TRUE;
-            return 1;
-        }
-
-        // Se não recebe UA, reenvia SET, 3 vezes (N_TRIES)
-        alarmCount = 0;
-        while (alarmCount < connectionParameters.nRetransmissions && ESTABLISHMENT == FALSE) {
-            if (alarmEnabled == FALSE) {       
-                send_SET(global_fd);
-                alarm(alarm_global);  
-                alarmEnabled = TRUE;
-
-                if (read_UA(global_fd) == 1) {
-                    ESTABLISHMENT = TRUE;
-                    alarm(0); 
-                    return 1;
+        // Envia SET e espera pelo UA até ao timeout; se não recebe UA, reenvia SET, 3 vezes (N_TRIES).
+        // Um recetor antigo rejeita o SET com parâmetros: sem resposta ao primeiro, os seguintes vão sem
+        // parâmetros e a ligação fica com os valores por omissão (stop-and-wait, BCC2, DEFAULT_INFO_SIZE)
+        for (int tries = 0; tries <= connectionParameters.nRetransmissions; tries++) {
+            struct timespec sent_at;
+            send_SET(session, tries > 0);
+            clock_gettime(CLOCK_MONOTONIC, &sent_at);
+            arm_timer(session, &sent_at, session->timeout_ms);
+
+            while (elapsed_ms(&sent_at) < session->timeout_ms) {
+                if (session->link_down) return open_failed(session);
+                if (read_UA(session) == 1) {
+                    session->established = TRUE;
+                    stop_timer(session);
+                    if (alloc_buffers(session) < 0) return open_failed(session);
+                    return session;
                 }
             }
         }
 
         printf("ERROR Establishment!\n");
-        return -1;
+        return open_failed(session);
     }
 
     if (connectionParameters.role == LlRx) {
         // Receiver:
-        while (1) {
+        while (!session->link_down) {
             // Lê SET, e envia UA
-            if (read_SET(global_fd)) {
-                send_UA(global_fd);
-                ESTABLISHMENT = TRUE;
-                return 1;
+            if (read_SET(session)) {
+                if (alloc_buffers(session) < 0) return open_failed(session);
+                send_UA(session);
+                session->established = TRUE;
+                return session;
             }
         }
     }
 
-    return -1;
+    return open_failed(session);
+}
+
+// Open a connection using the "port" parameters defined in struct linkLayer.
+// Return "1" on success or "-1" on error.
+int llopen(LinkLayer connectionParameters) {
+    default_session = llopen_session(connectionParameters);
+    return (default_session != NULL) ? 1 : -1;
+}
+
+// Calcula o instante em que a trama de length bytes acabada de escrever terá saído pela UART, ao baudRate
+// configurado: a trama sai depois das que ainda estão na fila de saída. Se o driver reporta a fila (TIOCOUTQ)
+// é ela que conta, e uma fila vazia (ptys, adaptadores USB, ligações mais rápidas que o baudRate) não deixa
+// acumular atrasos de tramas anteriores; senão a fila é estimada pelos bytes escritos (limitada pelas
+// confirmações, em clamp_drain_time). O temporizador da trama conta a partir daí, por isso só mede a
+// propagação e o processamento no recetor
+void drain_time(LinkSession *session, int length, struct timespec *drained) {
+    double ms_per_byte = BITS_PER_BYTE * 1E3 / session->connectionParameters.baudRate;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int queued;
+    if (ioctl(session->fd, TIOCOUTQ, &queued) == 0) {
+        session->tx_idle_at = now;
+        add_ms(&session->tx_idle_at, ((queued > length) ? queued : length) * ms_per_byte);
+    } else {
+        if (time_before(&session->tx_idle_at, &now)) session->tx_idle_at = now;
+        add_ms(&session->tx_idle_at, length * ms_per_byte);
+    }
+    *drained = session->tx_idle_at;
+}
+
+// Depois de uma confirmação só as tramas por confirmar podem estar na fila de saída: nenhuma sai depois de
+// agora mais o tempo de enviar as que estão à sua frente na janela
+void clamp_drain_time(LinkSession *session) {
+    double ms_per_byte = BITS_PER_BYTE * 1E3 / session->connectionParameters.baudRate;
+    struct timespec bound;
+    clock_gettime(CLOCK_MONOTONIC, &bound);
+
+    for (int i = 0; i < session->window_count; i++) {
+        int seq = (session->window_base + i) % session->seq_mod;
+        add_ms(&bound, session->window_lengths[seq] * ms_per_byte);
+        if (time_before(&bound, &session->window_sent_at[seq])) session->window_sent_at[seq] = bound;
+    }
+    if (time_before(&bound, &session->tx_idle_at)) session->tx_idle_at = bound;
+}
+
+// Recomeça a janela de adaptação (as medições contam a partir daqui)
+void reset_adapt_window(LinkSession *session) {
+    session->adapt_frames = 0;
+    session->adapt_bytes = 0;
+    session->adapt_errors_base = session->rej_count + session->srej_count + session->timeout_count;
+}
+
+// A mesma trama falhou seguidas vezes: as tramas estão grandes demais para a taxa de erros atual e não se
+// espera pelo fim da janela de adaptação (o limite de reenvios pode acabar antes) - o tamanho passa a metade
+void shrink_payload_size(LinkSession *session) {
+    if (!ADAPTIVE_FRAME_SIZE || session->payload_size <= MIN_INFO_SIZE) return;
+
+    int size = session->payload_size / 2;
+    if (size < MIN_INFO_SIZE) size = MIN_INFO_SIZE;
+    printf("\nTamanho das tramas: %d -> %d bytes (erros seguidos na mesma trama)\n", session->payload_size, size);
+    session->payload_size = size;
+    session->payload_adjustments++;
+    reset_adapt_window(session);
+}
+
+// Envia (ou reenvia) uma trama da janela e arranca o seu temporizador
+// Retorna 0 em caso de sucesso e -1 em caso de erro
+int send_window_frame(LinkSession *session, int seq) {
+    if (write_frame(session, session->window_frames[seq], session->window_lengths[seq]) == -1) {
+        printf("Error! Write Frames!\n");
+        return -1;
+    }
+    drain_time(session, session->window_lengths[seq], &session->window_sent_at[seq]);
+    session->window_sends[seq]++;
+    session->frames_sent++;
+    return 0;
+}
+
+// Reenvia uma só trama (SREJ ou timeout em Selective Repeat)
+// Retorna 0 em caso de sucesso e -1 em caso de erro
+int resend_frame(LinkSession *session, int seq) {
+    if (++session->window_retries[seq] >= session->connectionParameters.nRetransmissions) {
+        printf("Error: Max Retransmissions!\n");
+        return -1;
+    }
+    if (session->window_retries[seq] >= 2) shrink_payload_size(session);
+    session->frames_retransmitted++;
+    return send_window_frame(session, seq);
+}
+
+// Reenvia todas as tramas por confirmar, a partir de window_base (Go-Back-N)
+// Retorna 0 em caso de sucesso e -1 em caso de erro
+int resend_window(LinkSession *session) {
+    if (++session->window_retries[session->window_base] >= session->connectionParameters.nRetransmissions) {
+        printf("Error: Max Retransmissions!\n");
+        return -1;
+    }
+    if (session->window_retries[session->window_base] >= 2) shrink_payload_size(session);
+    for (int i = 0; i < session->window_count; i++) {
+        int seq = (session->window_base + i) % session->seq_mod;
+        session->frames_retransmitted++;
+        if (send_window_frame(session, seq) < 0) return -1;
+    }
+    return 0;
+}
+
+// Trata uma resposta do recetor. RR(n) confirma todas as tramas anteriores a n,
+// REJ(n) confirma as anteriores a n e obriga a reenviar a partir de n,
+// SREJ(n) pede só a trama n.
+// Retorna 0 em caso de sucesso e -1 em caso de erro
+int handle_reply(LinkSession *session, int response) {
+    int n = seq_S(session, response);
+    int acked = (n - session->window_base + session->seq_mod) % session->seq_mod;
+
+    // Resposta fora da janela (atrasada ou repetida)
+    if (acked > session->window_count) return 0;
+
+    if (session->arq_mode == ARQ_SELECTIVE && response == control_SREJ(session, n)) {
+        session->srej_count++;
+        if (acked == session->window_count) return 0;
+        return resend_frame(session, n);
+    }
+
+    // RTT da trama mais recente confirmada, se só foi enviada uma vez (regra de Karn)
+    if (acked > 0) {
+        int last = (n - 1 + session->seq_mod) % session->seq_mod;
+        double rtt = elapsed_ms(&session->window_sent_at[last]);
+        // Numa porta mais rápida que o baudRate a resposta pode chegar antes da saída calculada
+        if (rtt < 0) rtt = 0;
+        if (session->window_sends[last] == 1) rtt_sample(session, rtt);
+    }
+
+    session->window_base = n;
+    session->window_count -= acked;
+    if (acked > 0) clamp_drain_time(session);
+
+    if (response == control_RR(session, n)) return 0;
+
+    // REJ (se já confirmou a janela toda não há nada a reenviar)
+    session->rej_count++;
+    if (session->window_count == 0) return 0;
+    return resend_window(session);
+}
+
+// Verifica os temporizadores: em Go-Back-N o da trama mais antiga reenvia a janela toda,
+// em Selective Repeat cada trama expirada é reenviada sozinha.
+// Retorna 0 em caso de sucesso e -1 em caso de erro
+int check_timeouts(LinkSession *session) {
+    double timeout = session->rto;
+
+    if (session->arq_mode == ARQ_SELECTIVE) {
+        int expired = FALSE;
+        for (int i = 0; i < session->window_count; i++) {
+            int seq = (session->window_base + i) % session->seq_mod;
+            if (elapsed_ms(&session->window_sent_at[seq]) >= timeout) {
+                session->timeout_count++;
+                expired = TRUE;
+                if (resend_frame(session, seq) < 0) return -1;
+            }
+        }
+        if (expired) rto_backoff(session);
+        return 0;
+    }
+
+    if (session->window_count > 0 && elapsed_ms(&session->window_sent_at[session->window_base]) >= timeout) {
+        session->timeout_count++;
+        rto_backoff(session);
+        return resend_window(session);
+    }
+    return 0;
+}
+
+// Verifica se já chegaram bytes de uma resposta, sem bloquear
+int reply_available(LinkSession *session) {
+    if (session->rx_pos < session->rx_len) return TRUE;
+    struct pollfd pfd = { session->fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+// Arma o temporizador para o fim do prazo da trama por confirmar mais antiga
+// (em Selective Repeat a que foi enviada há mais tempo), ou desarma-o com a janela vazia
+void update_timer(LinkSession *session) {
+    if (session->window_count == 0) {
+        stop_timer(session);
+        return;
+    }
+
+    const struct timespec *oldest = &session->window_sent_at[session->window_base];
+    if (session->arq_mode == ARQ_SELECTIVE) {
+        for (int i = 1; i < session->window_count; i++) {
+            const struct timespec *sent_at = &session->window_sent_at[(session->window_base + i) % session->seq_mod];
+            if (time_before(sent_at, oldest)) oldest = sent_at;
+        }
+    }
+    arm_timer(session, oldest, session->rto);
+}
+
+// Espera por respostas até ficarem menos de "limit" tramas por confirmar,
+// reenviando as tramas cujo temporizador expira.
+// Retorna 0 em caso de sucesso e -1 em caso de erro
+int wait_window(LinkSession *session, int limit) {
+    while (session->window_count >= limit) {
+        if (session->link_down) return -1;
+        update_timer(session);
+        int response = read_Reply(session);
+        if (response != 0 && handle_reply(session, response) < 0) return -1;
+        if (check_timeouts(session) < 0) return -1;
+    }
+    return 0;
+}
+
+// Ajusta o tamanho recomendado dos dados no fim de uma janela de adaptação.
+// A taxa de tramas com erro (suavizada com a da janela anterior) dá o BER: FER = 1 - (1 - BER)^bits.
+// O débito útil L / (L + H) * (1 - BER)^(8 (L + H)) é máximo para L² + H L = H / k, com k = -8 ln(1 - BER),
+// e o tamanho anda metade do caminho até esse L em cada janela (arredondada para o lado dele, para lá chegar),
+// crescendo no máximo para o dobro
+void adapt_payload_size(LinkSession *session) {
+    unsigned long errors = session->rej_count + session->srej_count + session->timeout_count;
+    double fer = (double)(errors - session->adapt_errors_base) / session->adapt_frames;
+    double overhead = FRAME_OVERHEAD + check_size(session->frame_check) - 1;
+    double bits = 8.0 * ((double)session->adapt_bytes / session->adapt_frames + overhead);
+
+    session->fer = (session->fer + fer) / 2;
+    if (session->fer > 0.99) session->fer = 0.99;
+    session->ber_estimate = 1 - pow(1 - session->fer, 1 / bits);
+
+    int best = session->max_info;
+    if (session->ber_estimate > 0) {
+        double k = -8 * log(1 - session->ber_estimate);
+        double optimum = (-overhead + sqrt(overhead * overhead + 4 * overhead / k)) / 2;
+        if (optimum < best) best = (int)optimum;
+    }
+
+    int step = best - session->payload_size;
+    int size = session->payload_size + (step >= 0 ? step + 1 : step - 1) / 2;
+    if (abs(best - size) <= ADAPT_MARGIN * best) size = best;
+    if (size > 2 * session->payload_size) size = 2 * session->payload_size;
+    if (size < MIN_INFO_SIZE) size = MIN_INFO_SIZE;
+    if (size > session->max_info) size = session->max_info;
+    if (size != session->payload_size) {
+        if (abs(size - session->payload_size) > ADAPT_MARGIN * session->payload_size) {
+            printf("\nTamanho das tramas: %d -> %d bytes (FER %.3f, BER estimado %.2e)\n",
+                   session->payload_size, size, session->fer, session->ber_estimate);
+        }
+        session->payload_size = size;
+        session->payload_adjustments++;
+    }
+    reset_adapt_window(session);
+}
+
+// Tamanho recomendado dos dados do próximo llwrite
+int llpayload_size_session(LinkSession *session) {
+    if (session == NULL) return -1;
+    return ADAPTIVE_FRAME_SIZE ? session->payload_size : session->max_info;
+}
+
+int llpayload_size() {
+    return llpayload_size_session(default_session);
+}
+
+// Tamanho máximo dos dados de um llwrite/llread, acordado no llopen
+int llmax_payload_session(LinkSession *session) {
+    if (session == NULL) return -1;
+    return session->max_info;
+}
+
+int llmax_payload() {
+    return llmax_payload_session(default_session);
+}
+
+// Tempo que o outro lado pode levar a entregar uma trama: o primeiro envio e as nRetransmissions retransmissões,
+// cada uma depois de um RTO que duplica. O RTO do outro lado começa no timeout e só se adapta depois de ele
+// medir RTTs, por isso conta o maior dos dois
+int llreply_timeout_session(LinkSession *session) {
+    if (session == NULL) return -1;
+    double rto = (session->rto > session->timeout_ms) ? session->rto : session->timeout_ms;
+    double total = 0;
+    for (int i = 0; i <= session->connectionParameters.nRetransmissions; i++) {
+        total += rto;
+        if (ADAPTIVE_RTO) rto = (rto * 2 < RTO_MAX_MS) ? rto * 2 : RTO_MAX_MS;
+    }
+    return (int)total;
+}
+
+int llreply_timeout() {
+    return llreply_timeout_session(default_session);
+}
+
+// O SET (no recetor) ou o UA (no emissor) trouxe os parâmetros da ligação
+int llnegotiated_session(LinkSession *session) {
+    if (session == NULL) return -1;
+    return session->params_received;
+}
+
+int llnegotiated() {
+    return llnegotiated_session(default_session);
 }
 
 ////////////////////////////////////////////////
 // LLWRITE
 ////////////////////////////////////////////////
+// Envia os dados em buf pela sessão dada. Retorna o número de caracteres escritos ou -1 em caso de erro
+int llwrite_session(LinkSession *session, const unsigned char *buf, int bufSize) {
+    if (session == NULL) return -1;
+
+    // Os dados têm de caber no campo de informação acordado
+    if (bufSize > session->max_info) {
+        printf("Error: frame too large!\n");
+        return -1;
+    }
+
+    // Construir o frame (stuffing e campo de verificação numa só passagem) diretamente na janela, para eventual reenvio
+    unsigned char *frame = session->window_frames[session->Ns];
+    int length = (session->fec_parity > 0)
+        ? encode_frame_fec(session, frame, A, control_I(session, session->Ns), buf, bufSize)
+        : encode_frame(frame, A, control_I(session, session->Ns), buf, bufSize, session->frame_check);
+    session->window_lengths[session->Ns] = length;
+    session->window_retries[session->Ns] = 0;
+    session->window_sends[session->Ns] = 0;
+
+    if (send_window_frame(session, session->Ns) < 0) {
+        return -1;
+    }
+    session->Ns = (session->Ns + 1) % session->seq_mod;
+    session->window_count++;
+    session->total_bytes_sent += bufSize;
+
+    // Processa as respostas que já chegaram e, com a janela cheia, espera que deslize
+    update_timer(session);
+    while (reply_available(session) && session->window_count > 0) {
+        int response = read_Reply(session);
+        if (response != 0 && handle_reply(session, response) < 0) return -1;
+    }
+    if (check_timeouts(session) < 0) return -1;
+    if (wait_window(session, session->window_size) < 0) return -1;
+
+    session->adapt_bytes += bufSize;
+    if (ADAPTIVE_FRAME_SIZE && ++session->adapt_frames >= ADAPT_FRAMES) adapt_payload_size(session);
+
+    return length;
+}
+
 // Send data in buf with size bufSize.
 // Return number of chars written, or "-1" on error.
 int llwrite(const unsigned char *buf, int bufSize) {
-    // Construir o frame com Dados e BCC2
-    unsigned char frame[bufSize + 6];
-    frame[0] = FLAG;         
-    frame[1] = A;           
-    frame[2] = (Ns == 0) ? C_0 : C_1;   
-    
-    frame[3] = frame[1] ^ frame[2]; 
-    memcpy(&frame[4], buf, bufSize);   
-    frame[4 + bufSize] = get_BCC2(buf, bufSize);
-    frame[5 + bufSize] = FLAG; 
-    
-    // Fazer byte stuffing
-    unsigned char *stuffed_buf = byte_stuffing(frame, bufSize + 6);
-    
-    // Enviar o frame stuffed e caso necessário reenviar
-    int retries = 0;
-    int written;
-    (void)signal(SIGALRM, alarmHandler);
-
-    while (retries < 3) {
-        written = write_frame(stuffed_buf); 
-        if (written == -1) {
-            printf("Error! Write Frames!\n");
-            return -1;
-        }
-        
-        alarm(4);
-        alarmEnabled = 1;
-        int response = read_Reply(global_fd);
-        // Verificação da resposta em casos como RR0, RR1, REJ0, REJ1
-        if ((response == C_RR_0 && Ns ==1 ) || (response == C_RR_1 && Ns ==0)){
-            Ns = (response == C_RR_0) ? 0 : 1;
-            alarm(0);
-            return written;
-        } else if (response == C_REJ_0 || response == C_REJ_1) {
-            retries++;
-        } else {
-            retries++;
-        }
-    }
+    return llwrite_session(default_session, buf, bufSize);
+}
 
-    printf("Error: Max Retransmissions!\n");
-    return -1;
+// Entrega à camada de aplicação a próxima trama do buffer de reordenação
+// Retorna o número de caracteres entregues
+int deliver_buffered(LinkSession *session, unsigned char *packet) {
+    int payload_size = session->rx_lengths[session->next_deliver];
+    memcpy(packet, session->rx_frames[session->next_deliver], payload_size);
+    session->rx_received[session->next_deliver] = FALSE;
+    session->next_deliver = (session->next_deliver + 1) % session->seq_mod;
+    session->total_bytes_received += payload_size;
+    return payload_size;
 }
 
 ////////////////////////////////////////////////
 // LLREAD
 ////////////////////////////////////////////////
-// Receive data in packet.
-// Return number of chars read, or "-1" on error.
-int llread(unsigned char *packet) {
-    // Leitura do frame I
-    unsigned char stuffed_frame[BUF_SIZE] = {0};
-    int frame_size = read_I(global_fd, stuffed_frame);
+// Regista o REJ enviado (Go-Back-N). Sem prazo do chamador arma o temporizador: se nada chegar entretanto o REJ
+// pode ter-se perdido e deixa de contar
+void reject_pending(LinkSession *session, int timeout_ms) {
+    session->reject_sent = TRUE;
+    if (timeout_ms == 0) start_timer(session, session->timeout_ms);
+}
 
-    while(frame_size == 0) {
-        frame_size = read_I(global_fd, stuffed_frame);
-    }
+// Recebe dados da sessão dada para packet, esperando no máximo timeout_ms milissegundos (0: sem limite).
+// Retorna o número de caracteres lidos, 0 se o prazo acabou ou -1 em caso de erro
 
-    // Destuffing do frame
-    unsigned char *destuffed_frame = byte_destuffing(stuffed_frame, frame_size);
-    int frame_length = get_frame_length(destuffed_frame);
+int read_packet(LinkSession *session, unsigned char *packet, int timeout_ms) {
+    if (session == NULL) return -1;
 
-    // Caso o frame seja menor que 6 bytes, ou sejam: (FLAG, A, C, BCC1, BCC2, FLAG), é descartado imediatamente
-    if (frame_length <= 6) {
-        return -1;
+    unsigned char *stuffed_frame = session->stuffed_frame;
+    unsigned char *destuffed_frame = session->destuffed_frame;
+
+    // Troca de sentido: as tramas que esta sessão enviou têm de estar confirmadas antes de receber
+    if (session->window_count > 0 && wait_window(session, 1) < 0) return -1;
+
+    // O temporizador das tramas enviadas não pode interromper a receção a meio de uma trama
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (timeout_ms > 0) arm_timer(session, &start, timeout_ms);
+    else stop_timer(session);
+
+    // Primeiro entrega as tramas que já estão em ordem no buffer (Selective Repeat ou buffer_I)
+    if (session->next_deliver != session->Nr) {
+        return deliver_buffered(session, packet);
     }
 
-    // Verificação do BCC2
-    int computed_BCC2 = get_BCC2(&destuffed_frame[4], get_frame_length(destuffed_frame) - 6);
-    unsigned char received_BCC2 = destuffed_frame[frame_length - 2];
-    
-    if (computed_BCC2 != received_BCC2) {
-        // Em caso de erro, ou seja, BCC2 não é o esperado, envia REJ0 ou REJ1
-        if ((destuffed_frame[2] == C_0)) {
-            send_reply(global_fd, C_REJ_0);
-            llread(packet);
-        } else if (destuffed_frame[2] == C_1) {
-            send_reply(global_fd, C_REJ_1);
-            llread(packet);
+    while (1) {
+        // Leitura do frame I
+        int frame_size = read_I(session, stuffed_frame);
+        while(frame_size == 0) {
+            // Timeout: o REJ pode ter-se perdido, a próxima trama fora de ordem volta a ter REJ
+            session->reject_sent = FALSE;
+            if (session->link_down) return -1;
+            if (timeout_ms > 0 && elapsed_ms(&start) >= timeout_ms) {
+                stop_timer(session);
+                return 0;
+            }
+            frame_size = read_I(session, stuffed_frame);
         }
-        return -1;
-    }
-    
-    // Calcula o número de caracteres lidos
-    int payload_size = frame_length - 6;  
-    for (int i = 0; i < payload_size; i++) {
-        packet[i] = destuffed_frame[i + 4];
-    }
-    
-    // Caso o frame seja válido, envia RR0 ou RR1
-    if ((destuffed_frame[2] == C_0 && Nr == 0)){
-        Nr = (destuffed_frame[2] == C_1) ? 0 : 1;
-        send_reply(global_fd, C_RR_1);
 
-    } else if ((destuffed_frame[2] == C_0 && Nr == 1)) {
-        memset(packet,0, payload_size);
-        send_reply(global_fd, C_RR_1);
+        // Destuffing e verificação do frame numa só passagem (o tamanho vem do read_I, sem procurar FLAGs)
+        int valid;
+        int payload_size = decode_frame(session, stuffed_frame, frame_size, destuffed_frame, &valid);
+
+        // Caso o frame não tenha dados (FLAG, A, C, BCC1, campo de verificação, FLAG), é descartado imediatamente
+        if (payload_size <= 0) {
+            continue;
+        }
+
+        int seq = seq_I(session, destuffed_frame[2]);
+        // Trama repetida (já recebida, o RR perdeu-se): está até session->window_size números atrás de session->Nr.
+        // Só se distingue de uma trama adiantada se a janela não passar de metade do módulo
+        int behind = (session->Nr - seq + session->seq_mod) % session->seq_mod;
+        int duplicate = (2 * session->window_size <= session->seq_mod && behind >= 1 && behind <= session->window_size);
+        // Posição da trama na janela de receção (Selective Repeat)
+        int ahead = (seq - session->Nr + session->seq_mod) % session->seq_mod;
+
+        if (!valid) session->frames_rejected++;
+
+        if (duplicate) {
+            // Repetida: volta a confirmar (mesmo com erro nos dados)
+            session->frames_duplicated++;
+            send_reply(session, control_RR(session, session->Nr));
+            continue;
+        }
+
+        if (session->arq_mode == ARQ_SELECTIVE) {
+            if (ahead >= session->window_size) {
+                // Fora da janela de receção: volta a confirmar, caso o RR se tenha perdido
+                send_reply(session, control_RR(session, session->Nr));
+                continue;
+            }
+
+            if (!valid) {
+                // Cabeçalho correto mas dados com erro: pede só esta trama
+                if (!session->rx_received[seq]) {
+                    send_reply(session, control_SREJ(session, seq));
+                    session->srej_sent[seq] = TRUE;
+                }
+                continue;
+            }
+
+            // Guarda a trama no buffer de reordenação
+            if (!session->rx_received[seq]) {
+                memcpy(session->rx_frames[seq], &destuffed_frame[4], payload_size);
+                session->rx_lengths[seq] = payload_size;
+                session->rx_received[seq] = TRUE;
+                session->srej_sent[seq] = FALSE;
+                session->frames_received++;
+                if (seq != session->Nr) session->frames_buffered++;
+            }
+
+            if (seq != session->Nr) {
+                // Pede uma vez cada trama em falta antes desta
+                for (int n = session->Nr; n != seq; n = (n + 1) % session->seq_mod) {
+                    if (!session->rx_received[n] && !session->srej_sent[n]) {
+                        send_reply(session, control_SREJ(session, n));
+                        session->srej_sent[n] = TRUE;
+                    }
+                }
+                continue;
+            }
+
+            // Chegou session->Nr: avança sobre as tramas já guardadas e confirma-as todas de uma vez
+            while (session->rx_received[session->Nr] && ((session->Nr - session->next_deliver + session->seq_mod) % session->seq_mod) < session->window_size) {
+                session->Nr = (session->Nr + 1) % session->seq_mod;
+            }
+            send_reply(session, control_RR(session, session->Nr));
+            return deliver_buffered(session, packet);
+        }
 
-    } else if ((destuffed_frame[2] == C_1 && Nr == 1)) {
-        Nr = (destuffed_frame[2] == C_1) ? 0 : 1;
-        send_reply(global_fd, C_RR_0);
-    } else if ((destuffed_frame[2] == C_1 && Nr == 0)) {
-        memset(packet,0, payload_size);
-        send_reply(global_fd, C_RR_0);
+        if (!valid) {
+            // Em caso de erro na trama esperada envia REJ(session->Nr)
+            if (seq == session->Nr) {
+                send_reply(session, control_REJ(session, session->Nr));
+                reject_pending(session, timeout_ms);
+            }
+            continue;
+        }
+
+        if (seq != session->Nr) {
+            // Fora de ordem (perdeu-se uma trama) ou repetida: um só REJ(session->Nr), e depois RR(session->Nr)
+            // para cada uma, que confirma as repetidas se o RR se perdeu (um REJ por trama fazia o emissor
+            // reenviar a janela de cada vez)
+            if (!session->reject_sent) {
+                send_reply(session, control_REJ(session, session->Nr));
+                reject_pending(session, timeout_ms);
+            } else {
+                send_reply(session, control_RR(session, session->Nr));
+            }
+            continue;
+        }
+
+        // Calcula o número de caracteres lidos
+        for (int i = 0; i < payload_size; i++) {
+            packet[i] = destuffed_frame[i + 4];
+        }
+        session->frames_received++;
+        session->total_bytes_received += payload_size;
+
+        // Trama esperada: envia RR(session->Nr + 1)
+        session->Nr = (session->Nr + 1) % session->seq_mod;
+        session->next_deliver = session->Nr;
+        session->reject_sent = FALSE;
+        send_reply(session, control_RR(session, session->Nr));
+
+        return payload_size;
     }
+}
 
-    return payload_size;
+// Recebe dados da sessão dada para packet. Retorna o número de caracteres lidos ou -1 em caso de erro
+int llread_session(LinkSession *session, unsigned char *packet) {
+    return read_packet(session, packet, 0);
+}
+
+// Receive data in packet.
+// Return number of chars read, or "-1" on error.
+int llread(unsigned char *packet) {
+    return llread_session(default_session, packet);
+}
+
+// Como llread_session, mas desiste ao fim de timeout_ms milissegundos
+int llread_timeout_session(LinkSession *session, unsigned char *packet, int timeout_ms) {
+    int res = read_packet(session, packet, timeout_ms > 0 ? timeout_ms : 1);
+    if (session != NULL) stop_timer(session);
+    return res;
+}
+
+int llread_timeout(unsigned char *packet, int timeout_ms) {
+    return llread_timeout_session(default_session, packet, timeout_ms);
 }
 
 ////////////////////////////////////////////////
 // LLCLOSE
 ////////////////////////////////////////////////
-// Close previously opened connection.
-// if showStatistics == TRUE, link layer should print statistics in the console on close.
-// Return "1" on success or "-1" on error.
-int llclose(int showStatistics)
+// Imprime a distribuição dos RTT medidos e o estado final do estimador
+void print_rtt_statistics(LinkSession *session) {
+    if (session->rtt_samples == 0) {
+        printf("-> RTT: sem medições\n");
+        return;
+    }
+    printf("-> RTT (%lu medições): mín %.2f ms, média %.2f ms, máx %.2f ms\n", session->rtt_samples,
+           session->rtt_min, session->rtt_sum / session->rtt_samples, session->rtt_max);
+    printf("-> SRTT: %.2f ms, RTTVAR: %.2f ms, RTO final: %.2f ms%s\n", session->srtt, session->rttvar,
+           session->rto, ADAPTIVE_RTO ? "" : " (fixo)");
+    for (int i = 0; i < RTT_BUCKETS; i++) {
+        if (session->rtt_histogram[i] == 0) continue;
+        double share = 100.0 * session->rtt_histogram[i] / session->rtt_samples;
+        if (i == 0) printf("   [    0,     1) ms: %6lu (%5.1f%%)\n", session->rtt_histogram[i], share);
+        else if (i == RTT_BUCKETS - 1) printf("   [%5d,   ...) ms: %6lu (%5.1f%%)\n", 1 << (i - 1), session->rtt_histogram[i], share);
+        else printf("   [%5d, %5d) ms: %6lu (%5.1f%%)\n", 1 << (i - 1), 1 << i, session->rtt_histogram[i], share);
+    }
+}
+
+// Espera pela trama de supervisão lida por read_frame (read_DISC ou read_UA) até ao timeout, descartando o que
+// chegar antes (ex. uma trama I reenviada antes de chegar a última confirmação).
+// Retorna 1 se a trama chegou e 0 em timeout ou erro
+int wait_control(LinkSession *session, int (*read_frame)(LinkSession *)) {
+    struct timespec since;
+    clock_gettime(CLOCK_MONOTONIC, &since);
+    arm_timer(session, &since, session->timeout_ms);
+
+    while (!session->link_down && elapsed_ms(&since) < session->timeout_ms) {
+        if (read_frame(session)) {
+            stop_timer(session);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Termina a ligação da sessão (DISC/DISC/UA) e mostra as estatísticas.
+// Retorna 1 em caso de sucesso ou -1 em caso de erro
+int close_link(LinkSession *session, int showStatistics)
 {
-    if(global_connectionParameters.role == LlTx){
+    if(session->connectionParameters.role == LlTx){
         // Transmiter
 
+        // Espera pela confirmação das tramas que ainda estão na janela
+        if (wait_window(session, 1) < 0) {
+            return -1;
+        }
+
         // Envio DISC
-        send_DISC(global_fd);
+        send_DISC(session);
 
         // Lê DISC
-        if(read_DISC(global_fd)==0){
+        if (!wait_control(session, read_DISC)) {
             return -1;
         }
         
         // Envia UA
-        send_UA(global_fd);   
+        send_UA(session);   
     }
-    if(global_connectionParameters.role == LlRx){
+    if(session->connectionParameters.role == LlRx){
         // Receiver
 
         // Lê DISC
-        if(read_DISC(global_fd)==0){
+        if (!wait_control(session, read_DISC)) {
             return -1;
         }
 
         // Envia DISC
-        send_DISC(global_fd);
+        send_DISC(session);
         
         // Lê UA
-        if(read_UA(global_fd)==0){
+        if (!wait_control(session, read_UA)) {
             return -1;
         }
     }
 
-    // Finaliza o processo e fecha a ligação
     printf("\n 🐧 \n\n");
-    close(global_fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &session->end); // Registra o tempo final
+    double total_time = (session->end.tv_sec - session->start.tv_sec) + (session->end.tv_nsec - session->start.tv_nsec) / 1E9;
+
+    if (showStatistics) {
+        unsigned long total_bytes = (session->connectionParameters.role == LlTx) ? session->total_bytes_sent : session->total_bytes_received;
+        double link_capacity = session->connectionParameters.baudRate; // bits/s
+        double bitrate = (total_bytes * 8) / total_time; // bits/s
+        double efficiency = bitrate / link_capacity * 100; // (S=R/C) em %
+
+        printf("Estatísticas da transmissão:\n");
+        printf("-> Modo: %s, janela: %d\n", (session->window_size == 1) ? "Stop-and-Wait" : (session->arq_mode == ARQ_SELECTIVE) ? "Selective Repeat" : "Go-Back-N", session->window_size);
+        printf("-> Verificação das tramas: %s%s%s\n", check_name(session->frame_check),
+               (session->frame_check == CHECK_CRC32C) ? ", " : "", (session->frame_check == CHECK_CRC32C) ? crc32c_kernel_name() : "");
+        if (session->fec_parity > 0) {
+            printf("-> FEC: Reed-Solomon RS(%d,%d)\n", RS_BLOCK_SIZE, RS_BLOCK_SIZE - session->fec_parity);
+        }
+        printf("-> Bytes %s: %lu\n", (session->connectionParameters.role == LlTx) ? "enviados" : "recebidos", total_bytes);
+        printf("-> Tempo total: %.3f s\n", total_time);
+        printf("-> Taxa de bits efetiva (R): %.3f bits/s\n", bitrate);
+        printf("-> Capacidade do link (C): %.3f bits/s\n", link_capacity);
+        printf("-> Eficiência (S = R/C): %.3f%%\n", efficiency);
+        if (session->connectionParameters.role == LlTx) {
+            printf("-> Tramas enviadas: %lu (%lu retransmitidas)\n", session->frames_sent, session->frames_retransmitted);
+            printf("-> REJ recebidos: %lu, SREJ recebidos: %lu, timeouts: %lu\n", session->rej_count, session->srej_count, session->timeout_count);
+            print_rtt_statistics(session);
+            if (ADAPTIVE_FRAME_SIZE) {
+                printf("-> Tamanho das tramas: %d bytes no fim (%lu ajustes, BER estimado %.2e)\n",
+                       session->payload_size, session->payload_adjustments, session->ber_estimate);
+            }
+        } else {
+            printf("-> Tramas aceites: %lu (%lu fora de ordem guardadas)\n", session->frames_received, session->frames_buffered);
+            printf("-> Tramas com erro nos dados: %lu, repetidas: %lu\n", session->frames_rejected, session->frames_duplicated);
+            if (session->fec_parity > 0) {
+                printf("-> Tramas corrigidas pelo FEC: %lu (%lu bytes), por corrigir (retransmitidas): %lu\n",
+                       session->fec_frames_corrected, session->fec_bytes_corrected, session->frames_rejected);
+            }
+        }
+        printf("-> Chamadas a read(): %lu (%.2f por trama recebida)\n", session->read_calls, session->frames_parsed ? (double)session->read_calls / session->frames_parsed : 0.0);
+    }
+
     return 1;
 }
+
+// Fecha a ligação e liberta a sessão, mesmo em caso de erro
+int llclose_session(LinkSession *session, int showStatistics) {
+    if (session == NULL) return -1;
+
+    int res = close_link(session, showStatistics);
+
+    // Finaliza o processo e fecha a ligação
+    if (close(session->fd) != 0) res = -1;
+    close(session->timer_fd);
+    free(session->buffers);
+    free(session);
+    return res;
+}
+
+// Close previously opened connection.
+// if showStatistics == TRUE, link layer should print statistics in the console on close.
+// Return "1" on success or "-1" on error.
+int llclose(int showStatistics)
+{
+    int res = llclose_session(default_session, showStatistics);
+    default_session = NULL;
+    return res;
+}
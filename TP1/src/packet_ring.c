@@ -0,0 +1,111 @@
+// Fila circular de pacotes sem locks (uma thread produtora e uma consumidora)
+
+#include "packet_ring.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+// esperas ativas (sched_yield) antes de passar a dormir
+#define RING_SPINS 64
+// sleep entre verificações quando a espera é longa
+#define RING_SLEEP_NS 100000
+
+struct PacketRing {
+    int slots;
+    int slotSize;
+    unsigned char *buffers; // slots * slotSize bytes
+    int *sizes;
+
+    // head só é escrito pelo produtor e tail só pelo consumidor; head - tail é o número de pacotes na fila.
+    // Ficam em linhas de cache diferentes para as duas threads não se atrapalharem
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    atomic_int cancelled;
+};
+
+PacketRing *ring_create(int slots, int slotSize) {
+    if (slots <= 0 || (slots & (slots - 1)) != 0 || slotSize <= 0)
+        return NULL;
+
+    PacketRing *ring = aligned_alloc(64, sizeof(PacketRing));
+    if (ring == NULL)
+        return NULL;
+    ring->slots = slots;
+    ring->slotSize = slotSize;
+    ring->buffers = malloc((size_t)slots * slotSize);
+    ring->sizes = calloc(slots, sizeof(int));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->cancelled, 0);
+
+    if (ring->buffers == NULL || ring->sizes == NULL) {
+        ring_destroy(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void ring_destroy(PacketRing *ring) {
+    if (ring == NULL)
+        return;
+    free(ring->buffers);
+    free(ring->sizes);
+    free(ring);
+}
+
+// Espera um pouco: primeiro cede o processador, depois de várias tentativas dorme
+static void ring_wait(int *spins) {
+    if (*spins < RING_SPINS) {
+        (*spins)++;
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, RING_SLEEP_NS };
+        nanosleep(&ts, NULL);
+    }
+}
+
+unsigned char *ring_reserve(PacketRing *ring) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int spins = 0;
+    // fila cheia: espera que o consumidor liberte um slot
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= (unsigned int)ring->slots) {
+        if (atomic_load_explicit(&ring->cancelled, memory_order_relaxed))
+            return NULL;
+        ring_wait(&spins);
+    }
+    if (atomic_load_explicit(&ring->cancelled, memory_order_relaxed))
+        return NULL;
+    return &ring->buffers[(size_t)(head & (ring->slots - 1)) * ring->slotSize];
+}
+
+void ring_publish(PacketRing *ring, int size) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->sizes[head & (ring->slots - 1)] = size;
+    // release: o pacote e o tamanho ficam visíveis antes do novo head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+unsigned char *ring_peek(PacketRing *ring, int *size) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int spins = 0;
+    // fila vazia: espera que o produtor publique um pacote
+    while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+        if (atomic_load_explicit(&ring->cancelled, memory_order_relaxed))
+            return NULL;
+        ring_wait(&spins);
+    }
+    *size = ring->sizes[tail & (ring->slots - 1)];
+    return &ring->buffers[(size_t)(tail & (ring->slots - 1)) * ring->slotSize];
+}
+
+void ring_release(PacketRing *ring) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    // release: o consumidor acabou de ler o slot antes de o produtor o poder reutilizar
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+void ring_cancel(PacketRing *ring) {
+    atomic_store_explicit(&ring->cancelled, 1, memory_order_relaxed);
+}
@@ -0,0 +1,200 @@
+// Reed-Solomon sobre GF(2^8) (polinómio 0x11D, raízes do gerador 1, α, ..., α^(parity-1))
+
+#include "reed_solomon.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define GF_POLY 0x11D
+
+////////////////////////////////////////////////
+// TABELAS
+////////////////////////////////////////////////
+unsigned char gf_exp[512]; // duplicada para não ter de reduzir a soma dos logaritmos
+unsigned char gf_log[256];
+// Polinómios geradores de cada número de bytes de paridade (coeficientes do grau mais alto para o mais baixo,
+// sem o 1 do grau parity)
+unsigned char rs_generator[RS_MAX_PARITY + 1][RS_MAX_PARITY];
+pthread_once_t rs_once = PTHREAD_ONCE_INIT;
+
+// Gera as tabelas do corpo e os polinómios geradores (uma só vez, com pthread_once)
+void rs_init() {
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = x;
+        gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100) x ^= GF_POLY;
+    }
+    gf_exp[510] = gf_exp[0];
+    gf_exp[511] = gf_exp[1];
+
+    // g(x) = (x - 1)(x - α)...(x - α^(parity-1)), acumulado com um fator de cada vez
+    unsigned char g[RS_MAX_PARITY + 1] = { 1 };
+    for (int parity = 1; parity <= RS_MAX_PARITY; parity++) {
+        unsigned char root = gf_exp[parity - 1];
+        for (int j = parity; j > 0; j--) {
+            g[j] = g[j - 1] ^ (g[j] && root ? gf_exp[gf_log[g[j]] + gf_log[root]] : 0);
+        }
+        g[0] = g[0] ? gf_exp[gf_log[g[0]] + gf_log[root]] : 0;
+        // g[j] é o coeficiente do grau j: guarda do grau parity-1 até 0
+        for (int j = 0; j < parity; j++) rs_generator[parity][j] = g[parity - 1 - j];
+    }
+}
+
+static inline unsigned char gf_mul(unsigned char a, unsigned char b) {
+    return (a && b) ? gf_exp[gf_log[a] + gf_log[b]] : 0;
+}
+
+static inline unsigned char gf_div(unsigned char a, unsigned char b) {
+    return a ? gf_exp[gf_log[a] + 255 - gf_log[b]] : 0;
+}
+
+////////////////////////////////////////////////
+// BLOCOS
+////////////////////////////////////////////////
+// Paridade de um bloco: resto da divisão de d(x) x^parity por g(x), calculado com um LFSR
+static void encode_block(unsigned char *parity_out, const unsigned char *data, int size, int parity) {
+    const unsigned char *g = rs_generator[parity];
+    unsigned char r[RS_MAX_PARITY] = {0};
+    for (int i = 0; i < size; i++) {
+        unsigned char feedback = data[i] ^ r[0];
+        if (feedback) {
+            int lf = gf_log[feedback];
+            for (int j = 0; j < parity - 1; j++) {
+                r[j] = r[j + 1] ^ (g[j] ? gf_exp[lf + gf_log[g[j]]] : 0);
+            }
+            r[parity - 1] = g[parity - 1] ? gf_exp[lf + gf_log[g[parity - 1]]] : 0;
+        } else {
+            memmove(r, r + 1, parity - 1);
+            r[parity - 1] = 0;
+        }
+    }
+    memcpy(parity_out, r, parity);
+}
+
+// Corrige um bloco de n bytes (dados e paridade) no lugar: síndromes, Berlekamp-Massey, pesquisa de Chien e
+// Forney. O byte i do bloco é o coeficiente do grau n - 1 - i.
+// Retorna o número de bytes corrigidos, ou -1 se houver mais erros do que os que o código corrige
+static int decode_block(unsigned char *block, int n, int parity) {
+    unsigned char s[RS_MAX_PARITY];
+    int errors = 0;
+    for (int i = 0; i < parity; i++) {
+        unsigned char v = 0;
+        for (int k = 0; k < n; k++) {
+            v = (v ? gf_exp[gf_log[v] + i] : 0) ^ block[k];
+        }
+        s[i] = v;
+        errors |= v;
+    }
+    if (!errors) return 0;
+
+    // Polinómio localizador dos erros Λ(x)
+    unsigned char lambda[RS_MAX_PARITY + 1] = { 1 };
+    unsigned char prev[RS_MAX_PARITY + 1] = { 1 };
+    int L = 0, m = 1;
+    unsigned char b = 1;
+    for (int r = 0; r < parity; r++) {
+        unsigned char d = s[r];
+        for (int i = 1; i <= L; i++) d ^= gf_mul(lambda[i], s[r - i]);
+        if (d == 0) {
+            m++;
+            continue;
+        }
+        unsigned char coef = gf_div(d, b);
+        unsigned char saved[RS_MAX_PARITY + 1];
+        memcpy(saved, lambda, sizeof(saved));
+        for (int i = 0; i + m <= parity; i++) lambda[i + m] ^= gf_mul(coef, prev[i]);
+        if (2 * L <= r) {
+            L = r + 1 - L;
+            memcpy(prev, saved, sizeof(prev));
+            b = d;
+            m = 1;
+        } else {
+            m++;
+        }
+    }
+    if (2 * L > parity) return -1;
+
+    // Avaliador Ω(x) = S(x) Λ(x) mod x^parity
+    unsigned char omega[RS_MAX_PARITY] = {0};
+    for (int i = 0; i < parity; i++) {
+        for (int j = 0; j <= L && j <= i; j++) omega[i] ^= gf_mul(s[i - j], lambda[j]);
+    }
+
+    // Raízes de Λ: o erro no grau j anula Λ(α^-j)
+    int found = 0;
+    for (int j = 0; j < n; j++) {
+        int inv = (255 - j) % 255; // logaritmo de α^-j
+        unsigned char value = 0;
+        for (int i = 0; i <= L; i++) {
+            if (lambda[i]) value ^= gf_exp[gf_log[lambda[i]] + (inv * i) % 255];
+        }
+        if (value) continue;
+
+        // Forney: e = X Ω(X^-1) / Λ'(X^-1), com X = α^j
+        unsigned char num = 0, den = 0;
+        for (int i = 0; i < parity; i++) {
+            if (omega[i]) num ^= gf_exp[gf_log[omega[i]] + (inv * i) % 255];
+        }
+        for (int i = 1; i <= L; i += 2) {
+            if (lambda[i]) den ^= gf_exp[gf_log[lambda[i]] + (inv * (i - 1)) % 255];
+        }
+        if (den == 0) return -1;
+        block[n - 1 - j] ^= gf_mul(gf_exp[j], gf_div(num, den));
+        found++;
+    }
+    // Raízes fora do bloco (encurtado) ou em falta: erros a mais
+    if (found != L) return -1;
+    return found;
+}
+
+////////////////////////////////////////////////
+// CÓDIGO
+////////////////////////////////////////////////
+int rs_encoded_size(int size, int parity) {
+    int data = RS_BLOCK_SIZE - parity;
+    return size + parity * ((size + data - 1) / data);
+}
+
+int rs_decoded_size(int size, int parity) {
+    int rest = size % RS_BLOCK_SIZE;
+    return (size / RS_BLOCK_SIZE) * (RS_BLOCK_SIZE - parity) + (rest > parity ? rest - parity : 0);
+}
+
+int rs_encode(unsigned char *out, const unsigned char *data, int size, int parity) {
+    pthread_once(&rs_once, rs_init);
+    int j = 0;
+    for (int i = 0; i < size; i += RS_BLOCK_SIZE - parity) {
+        int chunk = (size - i < RS_BLOCK_SIZE - parity) ? size - i : RS_BLOCK_SIZE - parity;
+        memcpy(&out[j], &data[i], chunk);
+        encode_block(&out[j + chunk], &data[i], chunk, parity);
+        j += chunk + parity;
+    }
+    return j;
+}
+
+int rs_decode(unsigned char *out, const unsigned char *coded, int size, int parity) {
+    pthread_once(&rs_once, rs_init);
+    int corrected = 0, j = 0;
+    for (int i = 0; i < size; i += RS_BLOCK_SIZE) {
+        int n = (size - i < RS_BLOCK_SIZE) ? size - i : RS_BLOCK_SIZE;
+        if (n <= parity) {
+            corrected = -1;
+            continue;
+        }
+        unsigned char block[RS_BLOCK_SIZE];
+        memcpy(block, &coded[i], n);
+        int fixed = decode_block(block, n, parity);
+        if (fixed < 0) {
+            corrected = -1;
+            memcpy(&out[j], &coded[i], n - parity);
+        } else {
+            if (corrected >= 0) corrected += fixed;
+            memcpy(&out[j], block, n - parity);
+        }
+        j += n - parity;
+    }
+    return corrected;
+}